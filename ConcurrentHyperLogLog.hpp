@@ -0,0 +1,177 @@
+#pragma once
+
+#include "HyperLogLog.hpp"
+#include "HyperLogLogPacked.hpp"
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cassert>
+
+/**
+ * HyperLogLog sketch with m = 2^(logm) registers that can be updated by several threads at
+ * once. The 8 bit registers are packed 8 to a 64 bit atomic word and raised with a CAS loop
+ * (fetch-max). Most updates don't raise their register and get by with a single load, so
+ * threads rarely contend even on hot words.
+ *
+ * estimate() may run while writers are active: registers only grow, and it sees every word in
+ * some state between the start and the end of the call.
+ *
+ * Memory: m bytes
+ */
+class ConcurrentHyperLogLogSketch
+{
+    using packing = hll_packing<8>;
+    static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "estimate() reads the words as bytes.");
+
+public:
+    /**
+     * logm     log(m), non-negative
+     */
+    explicit ConcurrentHyperLogLogSketch(int logm)
+        : logm_(logm), mask_(uiexp2<uint64_t>(logm) - 1),
+          num_words_((uiexp2<size_t>(logm) + packing::per_word - 1) / packing::per_word),
+          W_(new std::atomic<uint64_t>[num_words_])
+    {
+        for (size_t w = 0; w < num_words_; w++)
+        {
+            W_[w].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    int logm() const { return logm_; }
+    int m() const { return (int)(mask_ + 1); }
+    size_t memory() const { return num_words_ * sizeof(uint64_t); }
+
+    /**
+     * Add hash value y: the lower logm bits select the register, the remaining bits the rank.
+     */
+    void add(uint64_t y)
+    {
+        const uint64_t y_up  = (y & mask_);
+        const uint64_t y_low = (y & ~mask_);
+        if (y_low == 0) {std::cerr<<"HLL FAILURE: Not enough bits in hash!\n"; throw;}
+
+        update((int)y_up, (uint8_t)(lzcnt(y) + 1));
+    }
+
+    /**
+     * Add n hash values Y[0], ..., Y[n-1].
+     */
+    void add_batch(const uint64_t *Y, size_t n)
+    {
+        for (size_t j = 0; j < n; j++)
+        {
+            add(Y[j]);
+        }
+    }
+
+    /**
+     * R[k] = max(R[k], p), atomically.
+     */
+    void update(int k, uint8_t p)
+    {
+        std::atomic<uint64_t> &w = W_[k / packing::per_word];
+        const int shift = (k % packing::per_word) * 8;
+        uint64_t old = w.load(std::memory_order_relaxed);
+        while (((old >> shift) & packing::field) < p)
+        {
+            const uint64_t raised = (old & ~(packing::field << shift)) | ((uint64_t)p << shift);
+            if (w.compare_exchange_weak(old, raised, std::memory_order_relaxed))
+                return;
+        }
+    }
+
+    /**
+     * Merge sketch into this one (both need to share logm and the hash function).
+     */
+    void merge(const HyperLogLogSketch &sketch)
+    {
+        assert(sketch.logm() == logm_ && "Can only merge sketches with equal m.");
+        const uint8_t *R = sketch.registers();
+        for (size_t w = 0; w < num_words_; w++)
+        {
+            uint64_t other = 0;
+            for (int l = 0; l < packing::per_word && w*packing::per_word + l < (size_t)m(); l++)
+            {
+                other |= (uint64_t)R[w*packing::per_word + l] << (l*8);
+            }
+            fetch_max(w, other);
+        }
+    }
+
+    /**
+     * Merge other into this sketch, other may be updated concurrently.
+     */
+    void merge(const ConcurrentHyperLogLogSketch &other)
+    {
+        assert(other.logm_ == logm_ && "Can only merge sketches with equal m.");
+        for (size_t w = 0; w < num_words_; w++)
+        {
+            fetch_max(w, other.W_[w].load(std::memory_order_relaxed));
+        }
+    }
+
+    /**
+     * Copy of the registers as a (single-threaded) HyperLogLogSketch.
+     */
+    HyperLogLogSketch snapshot() const
+    {
+        HyperLogLogSketch S(logm_);
+        for (int k = 0; k < m(); k++)
+        {
+            S.update(k, register_at(k));
+        }
+        return S;
+    }
+
+    /**
+     * Raw HLL estimate of the number of distinct hash values added so far.
+     */
+    double estimate() const
+    {
+        const int m = this->m();
+        /* by FlFuGaMe07: compute Z := ( sum_ 2^(-R[k]) )^-1, copying blocks of words */
+        constexpr int block = 16 * packing::per_word;
+        uint64_t B[block / packing::per_word];
+        hll_inverse_sum sum;
+        for (int k = 0; k < m; k += block)
+        {
+            const int n = std::min(block, m - k);
+            for (int w = 0; w*packing::per_word < n; w++)
+            {
+                B[w] = W_[k / packing::per_word + w].load(std::memory_order_relaxed);
+            }
+            sum.add((const uint8_t *)B, n); /* little endian: register k is byte k of the words */
+        }
+        double E = 1./sum.result();
+        /* by FlFuGaMe07: "raw" HLL estimate: E := alpha_m * m^2 * Z */
+        E = alpha(m) * m*m * E;
+        /* note that we're not doing small/large range corrections */
+        return E;
+    }
+
+private:
+    int logm_;
+    uint64_t mask_;
+    size_t num_words_;
+    std::unique_ptr<std::atomic<uint64_t>[]> W_; /* register k is byte k % 8 of word k / 8 */
+
+    uint8_t register_at(int k) const
+    {
+        const uint64_t w = W_[k / packing::per_word].load(std::memory_order_relaxed);
+        return (uint8_t)((w >> ((k % packing::per_word) * 8)) & packing::field);
+    }
+
+    /**
+     * Word w = register-wise max(word w, other), atomically.
+     */
+    void fetch_max(size_t w, uint64_t other)
+    {
+        uint64_t old = W_[w].load(std::memory_order_relaxed);
+        uint64_t raised = packing::max(old, other);
+        while (raised != old && !W_[w].compare_exchange_weak(old, raised, std::memory_order_relaxed))
+        {
+            raised = packing::max(old, other);
+        }
+    }
+};
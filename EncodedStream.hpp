@@ -0,0 +1,281 @@
+#pragma once
+
+#include "datastreams.hpp"
+#include "clhash/clhash.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <filesystem>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <cassert>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Encoded stream file format (native byte order), version 1:
+ *
+ * header   64 bytes, see encoded_stream_header
+ * offsets  num_keys + 1 uint64_t, key i is bytes[offsets[i], offsets[i+1])
+ * ids      num_tokens uint32_t, the stream as indices into the dictionary
+ * bytes    dict_bytes bytes, the keys back to back
+ *
+ * Keys are numbered in order of their first occurrence in the stream, so a new key always gets
+ * the next unused id: the dictionary is the stream with all repetitions removed.
+ */
+
+struct encoded_stream_header
+{
+    char magic[8];          /* "DICTSTRM" */
+    uint32_t version;
+    uint32_t reserved0;
+    uint64_t num_keys;
+    uint64_t num_tokens;
+    uint64_t dict_bytes;
+    uint8_t reserved[24];
+};
+static_assert(sizeof(encoded_stream_header) == 64, "Encoded stream header must be 64 bytes.");
+
+
+/**
+ * Data stream (of words) in the dictionary encoded format, read through mmap: opening it only
+ * maps the file, the keys are views into the mapping. Convert a stream with encode_stream()
+ * (or load_encoded_stream(), which caches the conversion of a text file).
+ *
+ * The views stay valid as long as the EncodedStream exists (also when it is moved).
+ */
+class EncodedStream
+{
+public:
+    static constexpr uint32_t version = 1;
+
+    /**
+     * path     path to file written by encode_stream()
+     */
+    explicit EncodedStream(const std::string &path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(encoded_stream_header))
+        {
+            if (fd >= 0)  ::close(fd);
+            std::cerr << "Couldn't open encoded stream file!\n";
+            throw;
+        }
+        size_ = st.st_size;
+        void *p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+        {
+            std::cerr << "Couldn't map encoded stream file!\n";
+            throw;
+        }
+        data_ = (const uint8_t *)p;
+        const encoded_stream_header &h = header();
+        if (std::memcmp(h.magic, "DICTSTRM", 8) != 0 || h.version != version
+            || h.num_keys > size_ || h.num_tokens > size_ || h.dict_bytes > size_ /* no overflow below */
+            || size_ != file_size_for(h.num_keys, h.num_tokens, h.dict_bytes))
+        {
+            munmap((void *)data_, size_);
+            data_ = nullptr;
+            std::cerr << "Not an encoded stream file (or unsupported version)!\n";
+            throw;
+        }
+    }
+    EncodedStream(EncodedStream &&other) noexcept
+        : data_(other.data_), size_(other.size_)
+    {
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+    EncodedStream(const EncodedStream &) = delete;
+    EncodedStream &operator=(const EncodedStream &) = delete;
+    ~EncodedStream()
+    {
+        if (data_ != nullptr)  munmap((void *)data_, size_);
+    }
+
+    /* number of tokens (stream length) */
+    uint64_t size() const { return header().num_tokens; }
+    /* number of distinct keys, i.e. the cardinality of the stream */
+    uint64_t num_keys() const { return header().num_keys; }
+
+    /* the stream, as ids of keys */
+    const uint32_t *ids() const { return (const uint32_t *)(data_ + sizeof(encoded_stream_header) + (num_keys() + 1) * sizeof(uint64_t)); }
+
+    std::string_view key(uint32_t id) const
+    {
+        const uint64_t *O = offsets();
+        return std::string_view(bytes() + O[id], O[id + 1] - O[id]);
+    }
+
+    /**
+     * The keys in order of first occurrence.
+     */
+    std::vector<std::string_view> keys() const
+    {
+        std::vector<std::string_view> K(num_keys());
+        for (uint32_t i = 0; i < (uint32_t)K.size(); i++)
+        {
+            K[i] = key(i);
+        }
+        return K;
+    }
+
+    /**
+     * The words of the stream, in order (views into the dictionary).
+     */
+    std::vector<std::string_view> tokens() const
+    {
+        std::vector<std::string_view> Z(size());
+        const uint32_t *I = ids();
+        for (size_t j = 0; j < Z.size(); j++)
+        {
+            Z[j] = key(I[j]);
+        }
+        return Z;
+    }
+
+    static size_t file_size_for(uint64_t num_keys, uint64_t num_tokens, uint64_t dict_bytes)
+    {
+        return sizeof(encoded_stream_header) + (num_keys + 1) * sizeof(uint64_t) + num_tokens * sizeof(uint32_t) + dict_bytes;
+    }
+
+private:
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+
+    const encoded_stream_header &header() const { return *(const encoded_stream_header *)data_; }
+    const uint64_t *offsets() const { return (const uint64_t *)(data_ + sizeof(encoded_stream_header)); }
+    const char *bytes() const { return (const char *)(ids() + size()); }
+};
+
+
+/**
+ * Write data stream Z (of words) in the dictionary encoded format to path (an existing file is
+ * replaced once the new one is complete).
+ *
+ * Z        data stream of std::string or std::string_view, fewer than 2^32 distinct words
+ * path     path to output file
+ */
+template <typename z_type>
+inline void encode_stream(const std::vector<z_type> &Z, const std::string &path)
+{
+    /* number the keys by first occurrence */
+    std::unordered_map<std::string_view, uint32_t> id;
+    std::vector<std::string_view> K;
+    std::vector<uint32_t> I(Z.size());
+    for (size_t j = 0; j < Z.size(); j++)
+    {
+        const auto it = id.emplace(std::string_view(Z[j]), (uint32_t)K.size()).first;
+        if (it->second == K.size())  K.push_back(it->first);
+        I[j] = it->second;
+    }
+    assert(K.size() < (uint64_t(1) << 32) && "Ids are 32 bit.");
+
+    std::vector<uint64_t> O(K.size() + 1, 0);
+    for (size_t i = 0; i < K.size(); i++)
+    {
+        O[i + 1] = O[i] + K[i].size();
+    }
+    encoded_stream_header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, "DICTSTRM", 8);
+    h.version = EncodedStream::version;
+    h.num_keys = K.size();
+    h.num_tokens = Z.size();
+    h.dict_bytes = O.back();
+
+    const std::string tmp_path = path + ".tmp";
+    FILE *f = std::fopen(tmp_path.c_str(), "wb");
+    if (f == nullptr) {std::cerr << "Couldn't open encoded stream file for output!\n"; throw;}
+    bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1
+           && std::fwrite(O.data(), sizeof(uint64_t), O.size(), f) == O.size()
+           && std::fwrite(I.data(), sizeof(uint32_t), I.size(), f) == I.size();
+    for (size_t i = 0; ok && i < K.size(); i++)
+    {
+        ok = std::fwrite(K[i].data(), 1, K[i].size(), f) == K[i].size();
+    }
+    if (std::fclose(f) != 0 || !ok || std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        std::cerr << "Couldn't write encoded stream file!\n";
+        throw;
+    }
+}
+
+
+/**
+ * The data stream (of words) of a text file in the dictionary encoded format, cached at
+ * cachepath: the file is tokenized (as read_stream()) and encoded only if the cache doesn't
+ * exist or is older than the file.
+ *
+ * filepath     path to text file
+ * cachepath    path to encoded stream file
+ */
+inline EncodedStream load_encoded_stream(const std::string &filepath, const std::string &cachepath)
+{
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    const auto cache_time = fs::last_write_time(cachepath, ec);
+    if (ec || cache_time < fs::last_write_time(filepath))
+    {
+        MappedStream text(filepath);
+        encode_stream(text.tokens(), cachepath);
+    }
+    return EncodedStream(cachepath);
+}
+
+
+/**
+ * Hash the dictionary of an encoded data stream, in order of first occurrence. Estimators that
+ * only see the first occurrence of a value (HLL, Recordinality, KMV; repetitions never change
+ * them) give the same results on these num_keys() hash values as on hash_stream().
+ *
+ * out_H        hash values, out_H[i] = hash(Z.key(i)), is overwritten
+ * hash         hash function (instance of clhasher struct)
+ * Z            encoded data stream
+ */
+inline void hash_keys(std::vector<uint64_t> &out_H, clhasher &hash, const EncodedStream &Z)
+{
+    out_H.resize(Z.num_keys());
+    constexpr size_t block = 256;
+    const char *keys[block];
+    size_t lengths[block];
+    for (size_t i = 0; i < out_H.size(); i += block)
+    {
+        const size_t n = std::min(block, out_H.size() - i);
+        for (size_t l = 0; l < n; l++)
+        {
+            const std::string_view key = Z.key((uint32_t)(i + l));
+            keys[l] = key.data();
+            lengths[l] = key.size();
+        }
+        hash.hash_many(keys, lengths, n, out_H.data() + i);
+    }
+}
+
+
+/**
+ * Hash an encoded data stream: every key of the dictionary is hashed once, the stream's hash
+ * values are looked up by id. Same result as hash_stream() on the words.
+ *
+ * out_Y        hash values, out_Y[j] = hash(Z[j]), is overwritten
+ * hash         hash function (instance of clhasher struct)
+ * Z            encoded data stream
+ */
+inline void hash_stream(std::vector<uint64_t> &out_Y, clhasher &hash, const EncodedStream &Z)
+{
+    std::vector<uint64_t> H;
+    hash_keys(H, hash, Z);
+    const uint32_t *I = Z.ids();
+    out_Y.resize(Z.size());
+    for (size_t j = 0; j < out_Y.size(); j++)
+    {
+        out_Y[j] = H[I[j]];
+    }
+}
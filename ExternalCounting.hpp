@@ -0,0 +1,240 @@
+#pragma once
+
+#include "PerfectCounting.hpp"
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <filesystem>
+#include <cstdio>
+#include <cstdint>
+#include <cassert>
+#include <unistd.h>
+
+/**
+ * I/O volume and time per phase of cardinality_external().
+ */
+struct external_count_stats
+{
+    uint64_t bytes_input = 0;         /* read from the input file */
+    uint64_t bytes_written = 0;       /* written to runs (incl. repartitioning) */
+    uint64_t bytes_reread = 0;        /* read back from runs */
+    int num_runs = 0;                 /* run files written */
+    uint64_t max_partition_keys = 0;  /* most distinct keys held in memory at once */
+    double seconds_partition = 0.0;   /* phase 1: input to runs */
+    double seconds_count = 0.0;       /* phase 2: runs to counts (incl. repartitioning) */
+};
+
+/* Runs are selected by hash bits 32 to 56: above the group index of FlatDistinctSet (which holds
+ * fewer than 2^32 keys) and below its tag (bits 57 to 63), so the words of a run stay spread over
+ * groups and tags when counted. */
+constexpr int external_partition_bits = 25;
+
+/**
+ * Partitioned runs of words on disk: every word goes to the run selected by log_runs bits of its
+ * perfect_hash() (starting at bit 32 + shift, see external_partition_bits), written as 32 bit
+ * length + bytes.
+ */
+class external_runs
+{
+public:
+    external_runs(const std::string &prefix, int log_runs, int shift, size_t buffer_bytes, external_count_stats &stats)
+        : log_runs_(log_runs), shift_(shift), stats_(stats)
+    {
+        assert(shift + log_runs <= external_partition_bits && "Partition bits would overlap the tag.");
+        const int num_runs = 1 << log_runs;
+        buffer_bytes = std::max<size_t>(4096, buffer_bytes / num_runs);
+        for (int r = 0; r < num_runs; r++)
+        {
+            paths_.push_back(prefix + "-" + std::to_string(r) + ".run");
+            FILE *f = std::fopen(paths_.back().c_str(), "wb");
+            if (f == nullptr) {std::cerr << "Couldn't open run file for output!\n"; throw;}
+            std::setvbuf(f, nullptr, _IOFBF, buffer_bytes);
+            files_.push_back(f);
+        }
+        stats_.num_runs += num_runs;
+    }
+    external_runs(const external_runs &) = delete;
+    external_runs &operator=(const external_runs &) = delete;
+    ~external_runs() { close(); }
+
+    void add(const std::string &z)
+    {
+        FILE *f = files_[(perfect_hash(z) >> (32 + shift_)) & ((1u << log_runs_) - 1)];
+        const uint32_t len = (uint32_t)z.size();
+        if (std::fwrite(&len, sizeof(len), 1, f) != 1 || std::fwrite(z.data(), 1, len, f) != len)
+            {std::cerr << "Couldn't write run file!\n"; throw;}
+        stats_.bytes_written += sizeof(len) + len;
+    }
+
+    void close()
+    {
+        for (FILE *f : files_)
+        {
+            if (std::fclose(f) != 0) {std::cerr << "Couldn't write run file!\n"; throw;}
+        }
+        files_.clear();
+    }
+
+    const std::vector<std::string> &paths() const { return paths_; }
+
+private:
+    int log_runs_;
+    int shift_;
+    external_count_stats &stats_;
+    std::vector<std::string> paths_;
+    std::vector<FILE *> files_;
+};
+
+/**
+ * Call f(word) for the words of a run file written by external_runs, until f returns false.
+ */
+template <typename F>
+inline void read_run(const std::string &path, F f, external_count_stats &stats)
+{
+    FILE *in = std::fopen(path.c_str(), "rb");
+    if (in == nullptr) {std::cerr << "Couldn't open run file for input!\n"; throw;}
+    std::string z;
+    uint32_t len;
+    while (std::fread(&len, sizeof(len), 1, in) == 1)
+    {
+        z.resize(len);
+        if (std::fread(z.data(), 1, len, in) != len) {std::cerr << "Couldn't read run file!\n"; throw;}
+        stats.bytes_reread += sizeof(len) + len;
+        if (!f(z))  break;
+    }
+    std::fclose(in);
+}
+
+/**
+ * Distinct words of a stream counted in memory: a word is appended to K, and removed again if
+ * it was seen. Tracks (approximately) the bytes used.
+ */
+struct external_distinct
+{
+    std::vector<std::string> K;
+    FlatDistinctSet<std::string> distinct;
+    size_t bytes = 0;
+
+    explicit external_distinct(size_t n) : distinct(K, n) {}
+
+    void add(const std::string &z)
+    {
+        K.push_back(z);
+        if (!distinct.insert((uint32_t)(K.size() - 1)))
+            K.pop_back();
+        else
+            bytes += sizeof(std::string) + z.size() + 16; /* key, string header, ~2 slots */
+    }
+};
+
+/**
+ * Number of distinct words in a run file. If they don't fit the memory budget (skew, or more
+ * distinct words than expected), the run is split into 16 further runs by the next hash bits.
+ */
+inline uint64_t count_run(const std::string &path, int shift, size_t memory_budget, external_count_stats &stats)
+{
+    constexpr int log_runs = 4;
+    const bool can_split = (shift + log_runs <= external_partition_bits);
+    bool fits = true;
+    {
+        external_distinct D(std::filesystem::file_size(path) / 8);
+        read_run(path, [&](const std::string &z) {
+            D.add(z);
+            fits = (D.bytes <= memory_budget || !can_split);
+            return fits;
+        }, stats);
+        if (fits)
+        {
+            std::filesystem::remove(path);
+            stats.max_partition_keys = std::max<uint64_t>(stats.max_partition_keys, D.K.size());
+            return D.distinct.size();
+        }
+    }
+
+    external_runs runs(path + "." + std::to_string(shift), log_runs, shift, memory_budget / 2, stats);
+    read_run(path, [&](const std::string &z) { runs.add(z); return true; }, stats);
+    runs.close();
+    std::filesystem::remove(path);
+    uint64_t count = 0;
+    for (const std::string &run : runs.paths())
+    {
+        count += count_run(run, shift + log_runs, memory_budget, stats);
+    }
+    return count;
+}
+
+
+/**
+ * Cardinality of the data stream (of words) in a file, for files larger than memory:
+ * - phase 1 streams the words into 2^r runs on disk, partitioned by hash, with r chosen such
+ *   that a run of the average size fits the memory budget,
+ * - phase 2 counts the distinct words of every run in memory (equal words share a run), splitting
+ *   runs whose distinct words don't fit the budget into further runs (see count_run()).
+ * Input that fits the budget as a whole is counted without spilling.
+ *
+ * filepath         path to file (words separated by white space, as for read_stream())
+ * memory_budget    bytes of memory to use (approximately)
+ * tmp_dir          directory for the runs
+ * stats            I/O volume and time per phase (optional)
+ */
+inline uint64_t cardinality_external(const std::string &filepath, size_t memory_budget,
+                                     const std::string &tmp_dir = std::filesystem::temp_directory_path().string(),
+                                     external_count_stats *stats = nullptr)
+{
+    using clock = std::chrono::steady_clock;
+    constexpr size_t bytes_factor = 8; /* memory per input byte if all words were distinct */
+    external_count_stats local_stats;
+    external_count_stats &S = (stats != nullptr ? *stats : local_stats);
+    S = external_count_stats();
+
+    std::ifstream datastream(filepath, std::ios_base::in);
+    if (!datastream.is_open())
+    {
+        std::cerr << "Couldn't open data stream input file!\n";
+        throw;
+    }
+    const uint64_t input_bytes = std::filesystem::file_size(filepath);
+    int log_runs = 0;
+    while ((input_bytes >> log_runs) * bytes_factor > memory_budget && log_runs < 16)  log_runs++;
+
+    /* phase 1: input to runs (a single run is read in place) */
+    const auto start = clock::now();
+    std::vector<std::string> runs;
+    if (log_runs > 0)
+    {
+        const std::string prefix = tmp_dir + "/cardinality-" + std::to_string(getpid());
+        external_runs writer(prefix, log_runs, 0, memory_budget / 2, S);
+        std::string z;
+        while (datastream >> z)
+        {
+            writer.add(z);
+        }
+        writer.close();
+        runs = writer.paths();
+    }
+    S.bytes_input = input_bytes;
+    const auto partitioned = clock::now();
+    S.seconds_partition = std::chrono::duration<double>(partitioned - start).count();
+
+    /* phase 2: count the runs */
+    uint64_t count = 0;
+    if (log_runs == 0)
+    {
+        external_distinct D(input_bytes / 8);
+        std::string z;
+        while (datastream >> z)
+        {
+            D.add(z);
+        }
+        S.max_partition_keys = D.K.size();
+        count = D.distinct.size();
+    }
+    for (const std::string &run : runs)
+    {
+        count += count_run(run, log_runs, memory_budget, S);
+    }
+    S.seconds_count = std::chrono::duration<double>(clock::now() - partitioned).count();
+    return count;
+}
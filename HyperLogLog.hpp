@@ -1,10 +1,14 @@
 #pragma once
 
 #include "clhash/clhash.h"
+#include "HyperLogLogKernels.hpp"
+#include "StreamSources.hpp"
 #include <vector>
 #include <cstring>
 #include <cstdint>
 #include <cassert>
+#include <iostream>
+#include <algorithm>
 
 /**
  * 2^x for non-negative integers
@@ -43,53 +47,254 @@ constexpr double alpha(int m)
 
 
 /**
- * HyperLogLog cardinality estimation, using stochastic averaging with m = 2^(logm) substreams.
+ * HyperLogLog sketch with m = 2^(logm) registers, fed incrementally with hash values.
  * 
- * hash     hash function (instance of clhasher struct)
- * Z        data stream / multiset
- * logm     log(m), non-negative
+ * Sketches built with the same hash function and logm can be merged (register-wise max),
+ * the result being the sketch of the union of both streams.
  * 
- * Memory: Expected m*loglogm bits
+ * Memory: m bytes (one 8 bit register per substream)
  */
-template <typename z_type>
-inline double hll(clhasher &hash, const std::vector<z_type> &Z, int logm)
+class HyperLogLogSketch
 {
-    const int m = uiexp2(logm);
-    const uint64_t mask = m - 1;
-
-    /* 8 bits for R --> supports up to 255 leading zeros in hash values */
-    uint8_t *R = new uint8_t[m];
-    std::memset(R, 0, m*sizeof(uint8_t));
+public:
+    /**
+     * logm     log(m), non-negative
+     */
+    explicit HyperLogLogSketch(int logm)
+        : logm_(logm), mask_(uiexp2<uint64_t>(logm) - 1), R_(uiexp2<size_t>(logm), 0)
+    {}
 
-    /* assert that P(exists z : h(z) == 0) <= Z.size() * (1/2)^{effective bits of hash} < 1 in a billion */
-    assert(Z.size() * 1000000000 / 2 < uiexp2<size_t>(64 - 1 - logm) && "Don't like my chances of not having enough bits in hash.");
+    int logm() const { return logm_; }
+    int m() const { return (int)R_.size(); }
+    const uint8_t *registers() const { return R_.data(); }
+    size_t memory() const { return R_.size(); }
 
-    for (int j = 0; j < (int)Z.size(); j++)
+    /**
+     * Add hash value y: the lower logm bits select the register, the remaining bits the rank.
+     */
+    void add(uint64_t y)
     {
-        const uint64_t y = hash(Z[j]);
-        const uint64_t y_up  = (y & mask);
-        const uint64_t y_low = (y & ~mask);
+        const uint64_t y_up  = (y & mask_);
+        const uint64_t y_low = (y & ~mask_);
         if (y_low == 0) {std::cerr<<"HLL FAILURE: Not enough bits in hash!\n"; throw;}
 
-        const uint64_t p = lzcnt(y) + 1;
-        if (p > R[y_up])
+        update((int)y_up, (uint8_t)(lzcnt(y) + 1));
+    }
+
+    /**
+     * R[k] = max(R[k], p)
+     */
+    void update(int k, uint8_t p)
+    {
+        if (p > R_[k])
+        {
+            R_[k] = p;
+        }
+    }
+
+    /**
+     * Add n hash values Y[0], ..., Y[n-1].
+     */
+    void add_batch(const uint64_t *Y, size_t n)
+    {
+        hll_update(R_.data(), mask_, Y, n);
+    }
+
+    /**
+     * Merge other into this sketch (both need to share logm and the hash function).
+     */
+    void merge(const HyperLogLogSketch &other)
+    {
+        assert(other.logm_ == logm_ && "Can only merge sketches with equal m.");
+        for (size_t k = 0; k < R_.size(); k++)
+        {
+            if (other.R_[k] > R_[k])  R_[k] = other.R_[k];
+        }
+    }
+
+    /**
+     * Sketch with m' = 2^(logm) <= m registers of the same stream: register k of the result is
+     * the max over the registers k + i*m' (those sharing the lower logm bits of the hash).
+     * Equals the sketch built with m' registers from the same hash values.
+     */
+    HyperLogLogSketch fold(int logm) const
+    {
+        assert(logm <= logm_ && "Can only fold to fewer registers.");
+        HyperLogLogSketch folded(logm);
+        const int m_folded = folded.m();
+        std::memcpy(folded.R_.data(), R_.data(), m_folded);
+        for (int i = m_folded; i < m(); i += m_folded)
         {
-            R[y_up] = (uint8_t)p;
+            for (int k = 0; k < m_folded; k++)
+            {
+                folded.R_[k] = std::max(folded.R_[k], R_[i + k]);
+            }
         }
+        return folded;
+    }
+
+    /**
+     * Raw HLL estimate of the number of distinct hash values added so far.
+     */
+    double estimate() const
+    {
+        const int m = this->m();
+        /* by FlFuGaMe07: compute Z := ( sum_ 2^(-R[k]) )^-1 */
+        hll_inverse_sum sum;
+        sum.add(R_.data(), m);
+        double E = 1./sum.result();
+        /* by FlFuGaMe07: "raw" HLL estimate: E := alpha_m * m^2 * Z */
+        E = alpha(m) * m*m * E;
+        /* note that we're not doing small/large range corrections */
+        return E;
     }
 
-    /* by FlFuGaMe07: compute Z := ( sum_ 2^(-R[k]) )^-1 */
-    double E = 0.0;
-    for (int k = 1; k < m; k++)
+private:
+    int logm_;
+    uint64_t mask_;
+    std::vector<uint8_t> R_; /* 8 bits for R --> supports up to 255 leading zeros in hash values */
+};
+
+
+/**
+ * Estimates for several m = 2^(logm[i]) <= m from one sketch, by folding it.
+ */
+inline std::vector<double> hll_estimates(const HyperLogLogSketch &sketch, const std::vector<int> &logm)
+{
+    std::vector<double> E;
+    for (int i = 0; i < (int)logm.size(); i++)
     {
-        const uint64_t tmp = uiexp2<uint64_t>(R[k]);
-        E += 1./tmp;
+        E.push_back(logm[i] == sketch.logm() ? sketch.estimate() : sketch.fold(logm[i]).estimate());
     }
-    E = 1./E;
-    /* by FlFuGaMe07: "raw" HLL estimate: E := alpha_m * m^2 * Z */
-    E = alpha(m) * m*m * E;
-    /* note that we're not doing small/large range corrections */
-    
-    delete[] R;
     return E;
-}
\ No newline at end of file
+}
+
+
+/**
+ * HyperLogLog cardinality estimation for several m = 2^(logm[i]) on precomputed hash values
+ * Y[0], ..., Y[n-1] (see hash_stream()), in a single scan.
+ *
+ * Return value: estimate per logm[i]
+ */
+inline std::vector<double> hll_hashed(const uint64_t *Y, size_t n, const std::vector<int> &logm)
+{
+    if (logm.empty())  return std::vector<double>();
+    const int logm_max = *std::max_element(logm.begin(), logm.end());
+
+    /* assert that P(exists z : h(z) == 0) <= n * (1/2)^{effective bits of hash} < 1 in a billion */
+    assert(n * 1000000000 / 2 < uiexp2<size_t>(64 - 1 - logm_max) && "Don't like my chances of not having enough bits in hash.");
+
+    HyperLogLogSketch sketch(logm_max);
+    sketch.add_batch(Y, n);
+    return hll_estimates(sketch, logm);
+}
+
+
+/**
+ * HyperLogLog cardinality estimation for several m = 2^(logm[i]) from a single scan: the sketch
+ * for the largest m is folded to every smaller m. Gives the same estimates as separate hll()
+ * calls.
+ *
+ * hash     hash function (instance of clhasher struct)
+ * Z        data stream / multiset
+ * logm     values log(m), non-negative
+ *
+ * Return value: estimate per logm[i]
+ */
+template <typename z_type>
+inline std::vector<double> hll(clhasher &hash, const std::vector<z_type> &Z, const std::vector<int> &logm)
+{
+    if (logm.empty())  return std::vector<double>();
+    const int logm_max = *std::max_element(logm.begin(), logm.end());
+
+    HyperLogLogSketch sketch(logm_max);
+
+    /* assert that P(exists z : h(z) == 0) <= Z.size() * (1/2)^{effective bits of hash} < 1 in a billion */
+    assert(Z.size() * 1000000000 / 2 < uiexp2<size_t>(64 - 1 - logm_max) && "Don't like my chances of not having enough bits in hash.");
+
+    /* hash blocks of the stream and feed them to the batched register update */
+    constexpr int block = 256;
+    uint64_t Y[block];
+    for (int j = 0; j < (int)Z.size(); j += block)
+    {
+        const int n = std::min(block, (int)Z.size() - j);
+        hash.hash_many(Z.data() + j, n, Y);
+        sketch.add_batch(Y, n);
+    }
+    return hll_estimates(sketch, logm);
+}
+
+
+/**
+ * HyperLogLog cardinality estimation, using stochastic averaging with m = 2^(logm) substreams.
+ * 
+ * hash     hash function (instance of clhasher struct)
+ * Z        data stream / multiset
+ * logm     log(m), non-negative
+ * 
+ * Memory: Expected m*loglogm bits
+ */
+template <typename z_type>
+inline double hll(clhasher &hash, const std::vector<z_type> &Z, int logm)
+{
+    return hll(hash, Z, std::vector<int>({logm}))[0];
+}
+
+
+/**
+ * HyperLogLog cardinality estimation for several m = 2^(logm[i]) on a pull source (see
+ * StreamSources.hpp), which is read once, chunk by chunk; same estimates as hll() on the whole
+ * stream.
+ *
+ * hash     hash function (instance of clhasher struct)
+ * source   pull source of the data stream / multiset
+ * logm     values log(m), non-negative
+ *
+ * Memory: the sketch for the largest m + one chunk, independent of the stream length
+ */
+template <typename source_type>
+inline std::vector<double> hll_stream(clhasher &hash, source_type &source, const std::vector<int> &logm)
+{
+    if (logm.empty())  return std::vector<double>();
+    const int logm_max = *std::max_element(logm.begin(), logm.end());
+
+    HyperLogLogSketch sketch(logm_max);
+    const uint64_t N = hash_source(hash, source, [&](const uint64_t *Y, size_t n) { sketch.add_batch(Y, n); });
+
+    /* the stream length is only known now, see hll() */
+    assert(N * 1000000000 / 2 < uiexp2<uint64_t>(64 - 1 - logm_max) && "Don't like my chances of not having enough bits in hash.");
+    (void)N;
+    return hll_estimates(sketch, logm);
+}
+
+template <typename source_type>
+inline double hll_stream(clhasher &hash, source_type &source, int logm)
+{
+    return hll_stream(hash, source, std::vector<int>({logm}))[0];
+}
+
+
+/**
+ * HyperLogLog cardinality estimation for several m = 2^(logm[i]) on a pre-aggregated stream: a
+ * table of keys K and multiplicities C (see read_frequencies()). The registers only depend on
+ * the set of keys, so every key with C[i] > 0 is hashed once: same estimates as hll() on any
+ * stream with these multiplicities, in time linear in the number of keys.
+ *
+ * hash     hash function (instance of clhasher struct)
+ * K        keys
+ * C        multiplicities, C[i] of K[i]
+ * logm     values log(m), non-negative
+ */
+template <typename z_type>
+inline std::vector<double> hll_weighted(clhasher &hash, const std::vector<z_type> &K, const std::vector<uint64_t> &C,
+                                        const std::vector<int> &logm)
+{
+    FrequencySource<z_type> source(K, C);
+    return hll_stream(hash, source, logm);
+}
+
+template <typename z_type>
+inline double hll_weighted(clhasher &hash, const std::vector<z_type> &K, const std::vector<uint64_t> &C, int logm)
+{
+    return hll_weighted(hash, K, C, std::vector<int>({logm}))[0];
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <iostream>
+#include <immintrin.h>
+
+/*
+ * Batched HyperLogLog kernels: register update from blocks of precomputed hash values and
+ * the harmonic sum over the registers.
+ *
+ * Every kernel has a scalar version and, if compiled with AVX2 support (e.g. -march=native in
+ * Release), an AVX2 version. The unsuffixed functions dispatch to the best available one.
+ * Scalar and AVX2 versions give bit-identical results.
+ */
+
+/**
+ * 2^(-r) for all possible ranks r (r <= 64)
+ */
+struct hll_inverse_pow2_table
+{
+    double v[65];
+    constexpr hll_inverse_pow2_table() : v()
+    {
+        double p = 1.0;
+        for (int r = 0; r < 65; r++, p /= 2)  v[r] = p;
+    }
+};
+inline constexpr hll_inverse_pow2_table hll_inverse_pow2{};
+
+
+/**
+ * Update registers R (8 bits each) with hash values Y[0], ..., Y[n-1]:
+ * R[y & mask] = max(R[y & mask], lzcnt(y) + 1)
+ *
+ * mask     m-1 for m registers
+ */
+inline void hll_update_scalar(uint8_t *R, uint64_t mask, const uint64_t *Y, size_t n)
+{
+    for (size_t j = 0; j < n; j++)
+    {
+        const uint64_t y = Y[j];
+        const uint64_t y_up  = (y & mask);
+        const uint64_t y_low = (y & ~mask);
+        if (y_low == 0) {std::cerr<<"HLL FAILURE: Not enough bits in hash!\n"; throw;}
+
+        const uint8_t p = (uint8_t)(__builtin_clzll(y) + 1);
+        if (p > R[y_up])  R[y_up] = p;
+    }
+}
+
+/**
+ * Sum of 2^(-R[k]) over the registers, accumulated in 16 lanes (lane k mod 16 takes R[k]).
+ * The fixed lane assignment makes the result independent of the instruction set used.
+ *
+ * Registers can be added in several calls, as long as all but the last call add a multiple
+ * of 16 registers.
+ */
+struct hll_inverse_sum
+{
+    static constexpr int lanes = 16;
+    double acc[lanes] = {};
+
+    double result() const
+    {
+        double s[lanes];
+        for (int l = 0; l < lanes; l++)  s[l] = acc[l];
+        for (int w = lanes/2; w > 0; w /= 2)
+            for (int l = 0; l < w; l++)  s[l] += s[l + w];
+        return s[0];
+    }
+
+    void add_scalar(const uint8_t *R, size_t n)
+    {
+        for (size_t k = 0; k < n; k++)
+        {
+            acc[k % lanes] += hll_inverse_pow2.v[R[k]];
+        }
+    }
+
+#ifdef __AVX2__
+    void add_avx2(const uint8_t *R, size_t n);
+#endif
+
+    void add(const uint8_t *R, size_t n)
+    {
+#ifdef __AVX2__
+        add_avx2(R, n);
+#else
+        add_scalar(R, n);
+#endif
+    }
+};
+
+
+#ifdef __AVX2__
+/**
+ * Number of leading 0's in each 64 bit lane (64 for 0).
+ */
+inline __m256i hll_lzcnt_epi64(__m256i y)
+{
+#if defined(__AVX512CD__) && defined(__AVX512VL__)
+    return _mm256_lzcnt_epi64(y);
+#else
+    /* lzcnt of every 32 bit half from the float exponent; clearing the bit below the leading 1
+     * keeps the int->float conversion from rounding up to the next power of two */
+    const __m256i x = _mm256_andnot_si256(_mm256_srli_epi32(y, 1), y);
+    __m256i e = _mm256_srli_epi32(_mm256_castps_si256(_mm256_cvtepi32_ps(x)), 23);
+    e = _mm256_and_si256(e, _mm256_set1_epi32(0xff)); /* drop sign */
+    __m256i lz32 = _mm256_min_epu32(_mm256_sub_epi32(_mm256_set1_epi32(127 + 31), e), _mm256_set1_epi32(32));
+    lz32 = _mm256_andnot_si256(_mm256_srai_epi32(y, 31), lz32); /* top bit set: 0 leading 0's */
+
+    /* combine halves: lzcnt(hi) if hi != 0, else 32 + lzcnt(lo) */
+    const __m256i hi = _mm256_srli_epi64(lz32, 32);
+    const __m256i lo = _mm256_and_si256(lz32, _mm256_set1_epi64x(0xffffffff));
+    const __m256i hi_zero = _mm256_cmpeq_epi64(hi, _mm256_set1_epi64x(32));
+    return _mm256_blendv_epi8(hi, _mm256_add_epi64(lo, hi), hi_zero);
+#endif
+}
+
+/**
+ * AVX2 version of hll_update_scalar(): bucket and rank are computed for 16 hash values at a
+ * time, then committed to R. Several hash values of a block hitting the same bucket are
+ * resolved by the commit, since it takes the max in order.
+ */
+inline void hll_update_avx2(uint8_t *R, uint64_t mask, const uint64_t *Y, size_t n)
+{
+    constexpr size_t block = 16;
+    const __m256i vmask = _mm256_set1_epi64x(mask);
+    const __m256i one = _mm256_set1_epi64x(1);
+    alignas(32) uint64_t bucket[block];
+    alignas(32) uint64_t rank[block];
+
+    size_t j = 0;
+    for (; j + block <= n; j += block)
+    {
+        __m256i fail = _mm256_setzero_si256();
+        for (size_t l = 0; l < block; l += 4)
+        {
+            const __m256i y = _mm256_loadu_si256((const __m256i *)(Y + j + l));
+            const __m256i y_low = _mm256_andnot_si256(vmask, y);
+            fail = _mm256_or_si256(fail, _mm256_cmpeq_epi64(y_low, _mm256_setzero_si256()));
+            _mm256_store_si256((__m256i *)(bucket + l), _mm256_and_si256(y, vmask));
+            _mm256_store_si256((__m256i *)(rank + l), _mm256_add_epi64(hll_lzcnt_epi64(y), one));
+        }
+        if (!_mm256_testz_si256(fail, fail)) {std::cerr<<"HLL FAILURE: Not enough bits in hash!\n"; throw;}
+
+        for (size_t l = 0; l < block; l++)
+        {
+            const uint8_t p = (uint8_t)rank[l];
+            if (p > R[bucket[l]])  R[bucket[l]] = p;
+        }
+    }
+    hll_update_scalar(R, mask, Y + j, n - j);
+}
+
+/**
+ * 2^(-r) is built directly from its exponent bits (1023 - r) << 52, which is the same value
+ * the scalar lookup table holds. The 16 lanes are four independent vector accumulators.
+ */
+inline void hll_inverse_sum::add_avx2(const uint8_t *R, size_t n)
+{
+    const __m256i bias = _mm256_set1_epi64x(1023);
+    __m256d vacc[4];
+    for (int v = 0; v < 4; v++)  vacc[v] = _mm256_loadu_pd(acc + 4*v);
+
+    size_t k = 0;
+    for (; k + lanes <= n; k += lanes)
+    {
+        const __m128i bytes = _mm_loadu_si128((const __m128i *)(R + k));
+        const __m256i r0 = _mm256_cvtepu8_epi64(bytes);
+        const __m256i r1 = _mm256_cvtepu8_epi64(_mm_srli_si128(bytes, 4));
+        const __m256i r2 = _mm256_cvtepu8_epi64(_mm_srli_si128(bytes, 8));
+        const __m256i r3 = _mm256_cvtepu8_epi64(_mm_srli_si128(bytes, 12));
+        vacc[0] = _mm256_add_pd(vacc[0], _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_sub_epi64(bias, r0), 52)));
+        vacc[1] = _mm256_add_pd(vacc[1], _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_sub_epi64(bias, r1), 52)));
+        vacc[2] = _mm256_add_pd(vacc[2], _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_sub_epi64(bias, r2), 52)));
+        vacc[3] = _mm256_add_pd(vacc[3], _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_sub_epi64(bias, r3), 52)));
+    }
+    for (int v = 0; v < 4; v++)  _mm256_storeu_pd(acc + 4*v, vacc[v]);
+    add_scalar(R + k, n - k);
+}
+#endif
+
+
+/**
+ * Update registers R with hash values Y[0], ..., Y[n-1] (see hll_update_scalar()).
+ */
+inline void hll_update(uint8_t *R, uint64_t mask, const uint64_t *Y, size_t n)
+{
+#ifdef __AVX2__
+    hll_update_avx2(R, mask, Y, n);
+#else
+    hll_update_scalar(R, mask, Y, n);
+#endif
+}
@@ -0,0 +1,375 @@
+#pragma once
+
+#include "HyperLogLog.hpp"
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+
+/**
+ * Bit masks for registers of width bits packed into 64 bit words. Registers never straddle
+ * words: a word holds per_word registers in its lowest per_word*bits bits.
+ */
+template <int bits>
+struct hll_packing
+{
+    static_assert(bits >= 4 && bits <= 8, "Unsupported register width.");
+    static constexpr int per_word = 64 / bits;
+    static constexpr uint64_t field = (uint64_t(1) << bits) - 1;
+    static constexpr uint64_t lsb = [] {
+        uint64_t l = 0;
+        for (int i = 0; i < per_word; i++)  l |= uint64_t(1) << (i*bits);
+        return l;
+    }();
+    static constexpr uint64_t msb = lsb << (bits - 1);
+
+    static constexpr uint64_t all = lsb * field;
+
+    /**
+     * Register-wise a - b (mod 2^bits), borrows are kept inside every field by the msb trick.
+     */
+    static constexpr uint64_t sub(uint64_t a, uint64_t b)
+    {
+        return ((a | msb) - (b & ~msb)) ^ ((a ^ ~b) & msb);
+    }
+
+    /**
+     * Mask of all registers with a < b (SWAR, no guard bits needed).
+     */
+    static constexpr uint64_t less(uint64_t a, uint64_t b)
+    {
+        /* borrow out of the top bit of a field <=> a < b in that field */
+        const uint64_t lt = ((~a & b) | ((~a | b) & sub(a, b))) & msb;
+        return (lt >> (bits - 1)) * field;
+    }
+
+    /**
+     * Register-wise max of the packed words a and b.
+     */
+    static constexpr uint64_t max(uint64_t a, uint64_t b)
+    {
+        return a ^ ((a ^ b) & less(a, b));
+    }
+
+    /**
+     * Register-wise max(a - b, 0), except that registers at the largest value stay there.
+     */
+    static constexpr uint64_t sub_saturated(uint64_t a, uint64_t b)
+    {
+        const uint64_t full = all & ~less(a, all);
+        const uint64_t d = sub(a, b) & ~less(a, b);
+        return (d & ~full) | (a & full);
+    }
+
+    /**
+     * Number of registers == 0 in the packed word w.
+     */
+    static constexpr int count_zero(uint64_t w)
+    {
+        constexpr uint64_t low = all & ~msb;
+        /* top bit of a field is set iff the field is non-zero (the sum stays inside the field) */
+        const uint64_t nonzero = (((w & low) + low) | w) & msb;
+        return per_word - __builtin_popcountll(nonzero);
+    }
+};
+
+
+/**
+ * HyperLogLog sketch with m = 2^(logm) registers of width bits (4, 5 or 6) packed into 64 bit
+ * words, fed incrementally with hash values.
+ *
+ * Registers are stored as offsets to a common base (the minimum over all registers, as in
+ * HLL-TailCut). The largest offset value marks an overflowed register whose rank is kept in a
+ * small side table (as Redis does for its sparse encoding). Nothing is truncated, so the
+ * estimate equals the one of HyperLogLogSketch on the same hash values.
+ *
+ * Memory: m*64/floor(64/bits) bits, plus 8 bytes per overflowed register
+ */
+template <int bits>
+class PackedHyperLogLogSketch
+{
+    using packing = hll_packing<bits>;
+    static constexpr uint8_t overflow = (uint8_t)packing::field;
+
+public:
+    /**
+     * logm     log(m), positive
+     */
+    explicit PackedHyperLogLogSketch(int logm)
+        : logm_(logm), mask_(uiexp2<uint64_t>(logm) - 1),
+          W_((uiexp2<size_t>(logm) + packing::per_word - 1) / packing::per_word, 0),
+          base_(0), num_at_base_(uiexp2<int>(logm))
+    {}
+
+    int logm() const { return logm_; }
+    int m() const { return (int)(mask_ + 1); }
+
+    /**
+     * Bytes used by the words and the overflow table.
+     */
+    size_t memory() const
+    {
+        return W_.size()*sizeof(uint64_t) + O_.size()*sizeof(O_[0]);
+    }
+
+    /**
+     * Rank held by register k.
+     */
+    uint8_t get(int k) const
+    {
+        const uint8_t v = field(k);
+        if (v == overflow)  return overflow_find(k)->second;
+        return base_ + v;
+    }
+
+    /**
+     * Add hash value y: the lower logm bits select the register, the remaining bits the rank.
+     */
+    void add(uint64_t y)
+    {
+        const uint64_t y_up  = (y & mask_);
+        const uint64_t y_low = (y & ~mask_);
+        if (y_low == 0) {std::cerr<<"HLL FAILURE: Not enough bits in hash!\n"; throw;}
+
+        update((int)y_up, (uint8_t)(lzcnt(y) + 1));
+    }
+
+    /**
+     * Add n hash values Y[0], ..., Y[n-1].
+     */
+    void add_batch(const uint64_t *Y, size_t n)
+    {
+        for (size_t j = 0; j < n; j++)
+        {
+            add(Y[j]);
+        }
+    }
+
+    /**
+     * R[k] = max(R[k], p)
+     */
+    void update(int k, uint8_t p)
+    {
+        if (p <= base_)  return; /* all registers are >= base */
+
+        const uint8_t v = field(k);
+        if (v == overflow)
+        {
+            auto it = overflow_find(k);
+            if (p > it->second)  it->second = p;
+            return;
+        }
+        if (p - base_ <= v)  return;
+
+        if (p - base_ >= overflow)
+        {
+            set_field(k, overflow);
+            O_.insert(std::lower_bound(O_.begin(), O_.end(), std::make_pair((uint32_t)k, (uint8_t)0)), {(uint32_t)k, p});
+        }
+        else
+            set_field(k, (uint8_t)(p - base_));
+
+        if (v == 0 && --num_at_base_ == 0)
+            rebase();
+    }
+
+    /**
+     * Merge other into this sketch (both need to share logm and the hash function).
+     */
+    void merge(const PackedHyperLogLogSketch &other)
+    {
+        assert(other.logm_ == logm_ && "Can only merge sketches with equal m.");
+        /* registers overflowed in either sketch: the merged rank goes to the overflow table
+         * (computed before the words change). Such a register may end up with a rank that would
+         * fit a field, which is fine since get() and decode() always look it up in the table */
+        std::vector<std::pair<uint32_t, uint8_t>> O;
+        O.reserve(O_.size() + other.O_.size());
+        auto it = O_.cbegin(), it_other = other.O_.cbegin();
+        while (it != O_.cend() || it_other != other.O_.cend())
+        {
+            if (it_other == other.O_.cend() || (it != O_.cend() && it->first < it_other->first))
+            {
+                O.push_back({it->first, std::max(it->second, other.get(it->first))});
+                it++;
+            }
+            else if (it == O_.cend() || it_other->first < it->first)
+            {
+                O.push_back({it_other->first, std::max(it_other->second, get(it_other->first))});
+                it_other++;
+            }
+            else
+            {
+                O.push_back({it->first, std::max(it->second, it_other->second)});
+                it++, it_other++;
+            }
+        }
+
+        /* word-wise max of the offsets to the larger of both bases (which is <= every merged
+         * register), overflowed registers keep the overflow value. Shifts beyond the overflow
+         * value saturate all fields anyway and are capped so they stay inside the fields */
+        const uint8_t base = std::max(base_, other.base_);
+        const uint64_t delta = std::min(base - base_, (int)overflow) * packing::lsb;
+        const uint64_t delta_other = std::min(base - other.base_, (int)overflow) * packing::lsb;
+        for (size_t w = 0; w < W_.size(); w++)
+        {
+            W_[w] = packing::max(packing::sub_saturated(W_[w], delta), packing::sub_saturated(other.W_[w], delta_other));
+        }
+        base_ = base;
+        O_.swap(O);
+        count_at_base();
+        if (num_at_base_ == 0)
+            rebase();
+    }
+
+    /**
+     * Raw HLL estimate of the number of distinct hash values added so far.
+     */
+    double estimate() const
+    {
+        const int m = this->m();
+        /* by FlFuGaMe07: compute Z := ( sum_ 2^(-R[k]) )^-1, decoding blocks of registers */
+        constexpr int block = 16 * packing::per_word; /* multiple of the lanes in hll_inverse_sum */
+        uint8_t R[block];
+        hll_inverse_sum sum;
+        for (int k = 0; k < m; k += block)
+        {
+            const int n = std::min(block, m - k);
+            decode(R, k, n);
+            sum.add(R, n);
+        }
+        double E = 1./sum.result();
+        /* by FlFuGaMe07: "raw" HLL estimate: E := alpha_m * m^2 * Z */
+        E = alpha(m) * m*m * E;
+        /* note that we're not doing small/large range corrections */
+        return E;
+    }
+
+    /**
+     * Write registers k0, ..., k0+n-1 to R (k0 a multiple of the registers per word).
+     */
+    void decode(uint8_t *R, int k0, int n) const
+    {
+        assert(k0 % packing::per_word == 0);
+        const uint64_t *w = W_.data() + k0 / packing::per_word;
+        int i = 0;
+        for (; i + packing::per_word <= n; i += packing::per_word, w++)
+        {
+            for (int l = 0; l < packing::per_word; l++)
+            {
+                R[i + l] = base_ + (uint8_t)((*w >> (l*bits)) & packing::field);
+            }
+        }
+        for (int l = 0; i < n; i++, l++)
+        {
+            R[i] = base_ + (uint8_t)((*w >> (l*bits)) & packing::field);
+        }
+        auto it = std::lower_bound(O_.begin(), O_.end(), std::make_pair((uint32_t)k0, (uint8_t)0));
+        for (; it != O_.end() && (int)it->first < k0 + n; it++)
+        {
+            R[it->first - k0] = it->second;
+        }
+    }
+
+    void decode(uint8_t *R) const { decode(R, 0, m()); }
+
+    /**
+     * Replace all registers by R[0], ..., R[m-1].
+     */
+    void encode(const uint8_t *R)
+    {
+        const int m = this->m();
+        base_ = *std::min_element(R, R + m);
+        O_.clear();
+        encode(R, 0, m, base_, O_);
+        count_at_base();
+    }
+
+private:
+    int logm_;
+    uint64_t mask_;
+    std::vector<uint64_t> W_;                          /* packed offsets to base_ */
+    std::vector<std::pair<uint32_t, uint8_t>> O_;      /* overflowed registers (index, rank), sorted */
+    uint8_t base_;                                     /* invariant: <= every register */
+    int num_at_base_;                                  /* invariant: number of fields == 0 */
+
+    uint8_t field(int k) const
+    {
+        const int shift = (k % packing::per_word) * bits;
+        return (uint8_t)((W_[k / packing::per_word] >> shift) & packing::field);
+    }
+
+    /**
+     * Overwrite registers k0, ..., k0+n-1 by R[0], ..., R[n-1] as offsets to base (k0 a multiple
+     * of the registers per word), appending overflowed registers to O.
+     */
+    void encode(const uint8_t *R, int k0, int n, uint8_t base, std::vector<std::pair<uint32_t, uint8_t>> &O)
+    {
+        assert(k0 % packing::per_word == 0);
+        for (int i = 0; i < n; i += packing::per_word)
+        {
+            const int len = std::min(packing::per_word, n - i);
+            uint64_t w = 0;
+            bool overflowed = false;
+            for (int l = 0; l < len; l++)
+            {
+                const uint8_t v = R[i + l] - base;
+                overflowed |= (v >= overflow);
+                w |= (uint64_t)std::min(v, overflow) << (l*bits);
+            }
+            if (overflowed)
+            {
+                for (int l = 0; l < len; l++)
+                {
+                    if (R[i + l] - base >= overflow)  O.push_back({(uint32_t)(k0 + i + l), R[i + l]});
+                }
+            }
+            W_[(k0 + i) / packing::per_word] = w;
+        }
+    }
+
+    void set_field(int k, uint8_t v)
+    {
+        const int shift = (k % packing::per_word) * bits;
+        uint64_t &w = W_[k / packing::per_word];
+        w = (w & ~(packing::field << shift)) | ((uint64_t)v << shift);
+    }
+
+    std::vector<std::pair<uint32_t, uint8_t>>::iterator overflow_find(int k)
+    {
+        return std::lower_bound(O_.begin(), O_.end(), std::make_pair((uint32_t)k, (uint8_t)0));
+    }
+
+    std::vector<std::pair<uint32_t, uint8_t>>::const_iterator overflow_find(int k) const
+    {
+        return std::lower_bound(O_.begin(), O_.end(), std::make_pair((uint32_t)k, (uint8_t)0));
+    }
+
+    /**
+     * Recount the registers at the base (the unused fields of the last word are always 0 and
+     * are subtracted).
+     */
+    void count_at_base()
+    {
+        num_at_base_ = 0;
+        for (uint64_t w : W_)
+        {
+            num_at_base_ += packing::count_zero(w);
+        }
+        num_at_base_ -= (int)(W_.size() * packing::per_word) - m();
+    }
+
+    /**
+     * Raise the base to the new minimum register (no register is at the base anymore).
+     */
+    void rebase()
+    {
+        std::vector<uint8_t> R(m());
+        decode(R.data());
+        encode(R.data());
+    }
+};
+
+using HyperLogLogSketch6 = PackedHyperLogLogSketch<6>;
+using HyperLogLogSketch5 = PackedHyperLogLogSketch<5>;
+using HyperLogLogSketch4 = PackedHyperLogLogSketch<4>;
@@ -0,0 +1,283 @@
+#pragma once
+
+#include "HyperLogLog.hpp"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+
+/**
+ * Append x to buf as varint (7 bits per byte, high bit set on all but the last byte).
+ */
+inline void varint_append(std::vector<uint8_t> &buf, uint32_t x)
+{
+    while (x >= 0x80)
+    {
+        buf.push_back((uint8_t)(x | 0x80));
+        x >>= 7;
+    }
+    buf.push_back((uint8_t)x);
+}
+
+/**
+ * Read a varint from p, advancing p past it.
+ */
+inline uint32_t varint_read(const uint8_t *&p)
+{
+    uint32_t x = 0;
+    for (int shift = 0; ; shift += 7)
+    {
+        const uint8_t b = *p++;
+        x |= (uint32_t)(b & 0x7f) << shift;
+        if (b < 0x80)  return x;
+    }
+}
+
+
+/**
+ * HyperLogLog sketch with m = 2^(logm) registers that starts out sparse (as in HLL++): only
+ * the non-zero registers are kept, as a sorted list of (index, rank) pairs encoded as varint
+ * deltas, plus a small unsorted buffer of recent updates. Once the sparse form would take more
+ * memory than the m byte registers of HyperLogLogSketch, it is converted to that dense form.
+ *
+ * Both forms give the same raw estimate (up to rounding of the harmonic sum); the sparse
+ * estimate only walks the list if there are buffered updates.
+ *
+ * Memory: min(2-3 bytes per non-zero register, m bytes)
+ */
+class SparseHyperLogLogSketch
+{
+public:
+    /**
+     * logm     log(m), positive and <= 24
+     */
+    explicit SparseHyperLogLogSketch(int logm)
+        : logm_(logm), mask_(uiexp2<uint64_t>(logm) - 1),
+          buffer_capacity_(std::max<size_t>(4, uiexp2<size_t>(logm) / 64)), num_sparse_(0)
+    {
+        assert(logm > 0 && logm <= 24 && "Sparse entries hold 24 bit register indices.");
+        buffer_.reserve(buffer_capacity_);
+    }
+
+    int logm() const { return logm_; }
+    int m() const { return (int)(mask_ + 1); }
+    bool is_sparse() const { return !dense_; }
+
+    /**
+     * Bytes used by the current representation.
+     */
+    size_t memory() const
+    {
+        if (dense_)  return dense_->memory();
+        return sparse_.size() + buffer_.capacity()*sizeof(uint32_t);
+    }
+
+    /**
+     * Add hash value y: the lower logm bits select the register, the remaining bits the rank.
+     */
+    void add(uint64_t y)
+    {
+        if (dense_)  return dense_->add(y);
+
+        const uint64_t y_up  = (y & mask_);
+        const uint64_t y_low = (y & ~mask_);
+        if (y_low == 0) {std::cerr<<"HLL FAILURE: Not enough bits in hash!\n"; throw;}
+
+        update((int)y_up, (uint8_t)(lzcnt(y) + 1));
+    }
+
+    /**
+     * Add n hash values Y[0], ..., Y[n-1].
+     */
+    void add_batch(const uint64_t *Y, size_t n)
+    {
+        size_t j = 0;
+        for (; j < n && !dense_; j++)
+        {
+            add(Y[j]);
+        }
+        if (j < n)  dense_->add_batch(Y + j, n - j);
+    }
+
+    /**
+     * R[k] = max(R[k], p)
+     */
+    void update(int k, uint8_t p)
+    {
+        if (dense_)  return dense_->update(k, p);
+
+        buffer_.push_back(entry(k, p));
+        if (buffer_.size() == buffer_capacity_)
+            flush();
+    }
+
+    /**
+     * Merge other into this sketch (both need to share logm and the hash function).
+     */
+    void merge(const SparseHyperLogLogSketch &other)
+    {
+        assert(other.logm_ == logm_ && "Can only merge sketches with equal m.");
+        if (other.dense_)
+        {
+            to_dense();
+            dense_->merge(*other.dense_);
+            return;
+        }
+        for (uint32_t e : other.entries())
+        {
+            update(e >> 8, e & 0xff);
+        }
+    }
+
+    /**
+     * Raw HLL estimate of the number of distinct hash values added so far.
+     */
+    double estimate() const
+    {
+        if (dense_)  return dense_->estimate();
+
+        const int m = this->m();
+        /* by FlFuGaMe07: compute Z := ( sum_ 2^(-R[k]) )^-1, zero registers contribute 1 each.
+         * The ranks of the sorted list are counted at every flush, so only buffered entries need
+         * a walk over the list */
+        int num_nonzero = (int)num_sparse_;
+        int count[64 + 1];
+        std::copy(sparse_count_, sparse_count_ + 64 + 1, count);
+        if (!buffer_.empty())
+        {
+            std::vector<uint32_t> B(buffer_);
+            std::sort(B.begin(), B.end());
+            const uint8_t *p = sparse_.data();
+            uint32_t e = 0;
+            size_t i = 0, b = 0;
+            if (num_sparse_ > 0)  e = varint_read(p);
+            while (b < B.size())
+            {
+                /* max rank of the buffered entries for this index */
+                const uint32_t k = B[b] >> 8;
+                while (b + 1 < B.size() && (B[b+1] >> 8) == k)  b++;
+                const uint8_t rank = B[b++] & 0xff;
+
+                while (i < num_sparse_ && (e >> 8) < k)
+                {
+                    if (++i < num_sparse_)  e += varint_read(p);
+                }
+                if (i < num_sparse_ && (e >> 8) == k)
+                {
+                    if (rank > (e & 0xff))  { count[e & 0xff]--; count[rank]++; }
+                }
+                else
+                {
+                    count[rank]++;
+                    num_nonzero++;
+                }
+            }
+        }
+        double sum = (double)(m - num_nonzero);
+        for (int r = 1; r <= 64; r++)
+        {
+            sum += count[r] * hll_inverse_pow2.v[r];
+        }
+        double E = 1./sum;
+        /* by FlFuGaMe07: "raw" HLL estimate: E := alpha_m * m^2 * Z */
+        E = alpha(m) * m*m * E;
+        /* note that we're not doing small/large range corrections */
+        return E;
+    }
+
+    /**
+     * Convert to the dense form (no-op if already dense).
+     */
+    void to_dense()
+    {
+        if (dense_)  return;
+        auto dense = std::make_unique<HyperLogLogSketch>(logm_);
+        for (uint32_t e : entries())
+        {
+            dense->update(e >> 8, e & 0xff);
+        }
+        dense_ = std::move(dense);
+        sparse_ = std::vector<uint8_t>();
+        buffer_ = std::vector<uint32_t>();
+        num_sparse_ = 0;
+    }
+
+    /**
+     * Move the buffer into the sorted sparse list, converting to dense once the list and a full
+     * buffer would exceed the m bytes of the dense registers. Happens whenever the buffer is
+     * full; flushing before repeated estimates makes them independent of the list length.
+     */
+    void flush()
+    {
+        if (dense_)  return;
+        const std::vector<uint32_t> E = entries();
+        std::vector<uint8_t> sparse;
+        sparse.reserve(sparse_.size() + 2*buffer_.size());
+        uint32_t prev = 0;
+        for (uint32_t e : E)
+        {
+            varint_append(sparse, e - prev);
+            prev = e;
+        }
+        sparse_.swap(sparse);
+        num_sparse_ = E.size();
+        std::fill(sparse_count_, sparse_count_ + 64 + 1, 0);
+        for (uint32_t e : E)
+        {
+            sparse_count_[e & 0xff]++;
+        }
+        buffer_.clear();
+
+        if (sparse_.size() + buffer_capacity_*sizeof(uint32_t) > (size_t)m())
+            to_dense();
+    }
+
+    /**
+     * The dense sketch (nullptr while sparse).
+     */
+    const HyperLogLogSketch *dense() const { return dense_.get(); }
+
+private:
+    int logm_;
+    uint64_t mask_;
+    size_t buffer_capacity_;
+    std::vector<uint8_t> sparse_;   /* varint deltas of the sorted entries (one per non-zero register) */
+    size_t num_sparse_;             /* number of entries in sparse_ */
+    int sparse_count_[64 + 1] = {}; /* number of entries in sparse_ per rank */
+    std::vector<uint32_t> buffer_;  /* unsorted entries not yet in sparse_ */
+    std::unique_ptr<HyperLogLogSketch> dense_;
+
+    /* an entry packs register index k and rank p, ordering entries by index first */
+    static uint32_t entry(int k, uint8_t p) { return ((uint32_t)k << 8) | p; }
+
+    /**
+     * Sorted entries of sparse_ and buffer_, one per non-zero register holding its max rank.
+     */
+    std::vector<uint32_t> entries() const
+    {
+        std::vector<uint32_t> E;
+        E.reserve(num_sparse_ + buffer_.size());
+        const uint8_t *p = sparse_.data();
+        uint32_t e = 0;
+        for (size_t i = 0; i < num_sparse_; i++)
+        {
+            e += varint_read(p);
+            E.push_back(e);
+        }
+        const size_t mid = E.size();
+        E.insert(E.end(), buffer_.begin(), buffer_.end());
+        std::sort(E.begin() + mid, E.end());
+        std::inplace_merge(E.begin(), E.begin() + mid, E.end());
+
+        /* keep the last (largest rank) entry of every index */
+        size_t n = 0;
+        for (size_t i = 0; i < E.size(); i++)
+        {
+            if (i + 1 < E.size() && (E[i+1] >> 8) == (E[i] >> 8))  continue;
+            E[n++] = E[i];
+        }
+        E.resize(n);
+        return E;
+    }
+};
@@ -1,22 +1,325 @@
 #pragma once
 
 #include <vector>
-#include <unordered_set>
 #include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <cassert>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Hash of key z for exact counting (see FlatDistinctSet): std::hash, which is the identity for
+ * integers, followed by the 64 bit finalizer of MurmurHash3 to spread it over all bits.
+ */
+template <typename z_type>
+inline uint64_t perfect_hash(const z_type &z)
+{
+    uint64_t h = std::hash<z_type>()(z);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccd;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53;
+    h ^= h >> 33;
+    return h;
+}
+
+
+/**
+ * Set of the distinct keys of a stream, held as references (indices) into the stream in a flat
+ * open addressing table of groups of 16 slots. Every slot has a control byte: empty, or 7 bits
+ * of the key's hash. A lookup compares the control bytes of a whole group at once (SSE2), so
+ * keys are only compared on a tag match, and moves on to further groups by triangular probing.
+ *
+ * The table is sized from the stream length n (at most 7/8 full), so it never grows while the
+ * keys of the stream are inserted; only inserting more than n keys doubles it, rehashing the keys
+ * it references. Keys are never copied, and need to stay in place while the set is used.
+ *
+ * Memory: 5 bytes per slot, 8/7 to 16/7 slots per element of the stream
+ */
+template <typename z_type>
+class FlatDistinctSet
+{
+    static constexpr int group_size = 16;
+    static constexpr uint8_t empty = 0x80;
+
+public:
+    /**
+     * Z        stream the keys are taken from
+     * n        number of keys that will be inserted (at most)
+     */
+    FlatDistinctSet(const std::vector<z_type> &Z, size_t n)
+        : Z_(Z), size_(0)
+    {
+        /* room for all n keys */
+        size_t num_slots = group_size;
+        while (num_slots * 7 < n * 8)  num_slots *= 2;
+        allocate(num_slots);
+    }
+    explicit FlatDistinctSet(const std::vector<z_type> &Z)
+        : FlatDistinctSet(Z, Z.size())
+    {}
+
+    /* number of distinct keys inserted */
+    uint64_t size() const { return size_; }
+
+    /**
+     * Insert key Z[j]; true iff it wasn't in the set yet.
+     */
+    bool insert(uint32_t j)
+    {
+        return insert(j, perfect_hash(Z_[j]));
+    }
+
+    /**
+     * Insert key Z[j] with precomputed h = perfect_hash(Z[j]).
+     */
+    bool insert(uint32_t j, uint64_t h)
+    {
+        const uint8_t tag = (uint8_t)(h >> 57);
+        size_t g = h & group_mask_;
+        for (size_t step = 1; ; step++)
+        {
+            const uint8_t *C = C_.get() + g*group_size;
+            for (uint32_t match = match_byte(C, tag); match != 0; match &= match - 1)
+            {
+                if (Z_[I_[g*group_size + __builtin_ctz(match)]] == Z_[j])  return false;
+            }
+            const uint32_t free = match_byte(C, empty);
+            if (free != 0)
+            {
+                if (size_ + 1 > max_size_)
+                {
+                    grow();
+                    return insert(j, h);
+                }
+                place(g*group_size + __builtin_ctz(free), tag, j);
+                return true;
+            }
+            g = (g + step) & group_mask_;
+        }
+    }
+
+private:
+    const std::vector<z_type> &Z_;
+    size_t group_mask_;              /* number of groups - 1 */
+    std::unique_ptr<uint8_t[]> C_;   /* control bytes: empty or the top 7 bits of the hash */
+    std::unique_ptr<uint32_t[]> I_;  /* index into Z of the key in each slot */
+    uint64_t size_;
+    uint64_t max_size_;              /* 7/8 of the slots */
+
+    void allocate(size_t num_slots)
+    {
+        group_mask_ = num_slots / group_size - 1;
+        max_size_ = num_slots / 8 * 7;
+        C_.reset(new uint8_t[num_slots]);
+        std::memset(C_.get(), empty, num_slots);
+        I_.reset(new uint32_t[num_slots]);
+    }
+
+    void place(size_t slot, uint8_t tag, uint32_t j)
+    {
+        C_[slot] = tag;
+        I_[slot] = j;
+        size_++;
+    }
+
+    /**
+     * Double the slots, rehashing the keys from the stream (all distinct, so no compares).
+     */
+    void grow()
+    {
+        const size_t num_slots = (group_mask_ + 1) * group_size;
+        std::unique_ptr<uint8_t[]> C = std::move(C_);
+        std::unique_ptr<uint32_t[]> I = std::move(I_);
+        allocate(2 * num_slots);
+        size_ = 0;
+        for (size_t slot = 0; slot < num_slots; slot++)
+        {
+            if (C[slot] == empty)  continue;
+            const uint64_t h = perfect_hash(Z_[I[slot]]);
+            size_t g = h & group_mask_;
+            uint32_t free;
+            for (size_t step = 1; (free = match_byte(C_.get() + g*group_size, empty)) == 0; step++)
+            {
+                g = (g + step) & group_mask_;
+            }
+            place(g*group_size + __builtin_ctz(free), C[slot], I[slot]);
+        }
+    }
+
+    /* bit i set iff C[i] == b, for the 16 control bytes of a group */
+    static uint32_t match_byte(const uint8_t *C, uint8_t b)
+    {
+#ifdef __SSE2__
+        const __m128i c = _mm_loadu_si128((const __m128i *)C);
+        return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8((char)b)));
+#else
+        uint32_t mask = 0;
+        for (int i = 0; i < group_size; i++)
+        {
+            mask |= (uint32_t)(C[i] == b) << i;
+        }
+        return mask;
+#endif
+    }
+};
+
 
 /**
  * Cardinality of data stream / multiset Z (is whole number).
  */
 template <typename z_type>
-inline double cardinality(const std::vector<z_type> &Z)
+inline uint64_t cardinality(const std::vector<z_type> &Z)
+{
+    assert(Z.size() < (uint64_t(1) << 32) && "The flat set holds 32 bit indices.");
+    FlatDistinctSet<z_type> Zprime(Z);
+    for (uint32_t j = 0; j < (uint32_t)Z.size(); j++)
+    {
+        Zprime.insert(j);
+    }
+    return Zprime.size();
+}
+
+
+/**
+ * Cardinality of data stream / multiset Z with num_threads threads, radix partitioned:
+ * - every thread hashes its slice of Z and counts the hashes per partition (bits 32 and up of
+ *   the hash, independent of the bits FlatDistinctSet uses),
+ * - every thread scatters (hash, index) of its slice into its ranges of the partitions,
+ * - the threads take partitions one by one and count their distinct keys with a FlatDistinctSet
+ *   each, comparing the keys on hash tag matches.
+ * Equal keys share a partition, so the counts add up to the cardinality.
+ *
+ * Memory: 20 bytes per element of Z (hashes, then partitioned hashes and indices)
+ */
+template <typename z_type>
+inline uint64_t cardinality(const std::vector<z_type> &Z, int num_threads)
+{
+    assert(Z.size() < (uint64_t(1) << 32) && "Partitions hold 32 bit indices.");
+    constexpr int log_partitions = 8;
+    constexpr int num_partitions = 1 << log_partitions;
+    num_threads = std::max(1, num_threads);
+    const size_t n = Z.size();
+    const size_t slice = (n + num_threads - 1) / num_threads;
+    auto run = [num_threads](auto f) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; t++)  threads.emplace_back(f, t);
+        for (auto &thread : threads)  thread.join();
+    };
+    auto partition = [](uint64_t h) { return (size_t)(h >> 32) & (num_partitions - 1); };
+
+    /* hash the slices and count the hashes per thread and partition */
+    std::vector<uint64_t> H(n);
+    std::vector<size_t> offset((size_t)num_threads * num_partitions + 1, 0);
+    run([&](int t) {
+        size_t *count = offset.data() + (size_t)t * num_partitions;
+        for (size_t j = t*slice; j < std::min(n, (t+1)*slice); j++)
+        {
+            H[j] = perfect_hash(Z[j]);
+            count[partition(H[j])]++;
+        }
+    });
+    /* partition p holds the ranges of threads 0, ..., num_threads-1 in turn */
+    std::vector<size_t> begin(num_partitions + 1);
+    size_t sum = 0;
+    for (int p = 0; p < num_partitions; p++)
+    {
+        begin[p] = sum;
+        for (int t = 0; t < num_threads; t++)
+        {
+            const size_t count = offset[(size_t)t * num_partitions + p];
+            offset[(size_t)t * num_partitions + p] = sum;
+            sum += count;
+        }
+    }
+    begin[num_partitions] = sum;
+
+    /* scatter the hashes and indices into the partitions */
+    std::vector<uint64_t> PH(n);
+    std::vector<uint32_t> PI(n);
+    run([&](int t) {
+        size_t *next = offset.data() + (size_t)t * num_partitions;
+        for (size_t j = t*slice; j < std::min(n, (t+1)*slice); j++)
+        {
+            const size_t i = next[partition(H[j])]++;
+            PH[i] = H[j];
+            PI[i] = (uint32_t)j;
+        }
+    });
+    H = std::vector<uint64_t>();
+
+    /* count the distinct keys per partition */
+    std::atomic<int> next_partition(0);
+    std::atomic<uint64_t> total(0);
+    run([&](int) {
+        uint64_t count = 0;
+        for (int p; (p = next_partition++) < num_partitions; )
+        {
+            FlatDistinctSet<z_type> Zprime(Z, begin[p+1] - begin[p]);
+            for (size_t i = begin[p]; i < begin[p+1]; i++)
+            {
+                Zprime.insert(PI[i], PH[i]);
+            }
+            count += Zprime.size();
+        }
+        total += count;
+    });
+    return total;
+}
+
+
+/**
+ * Cardinality of a data stream read from a pull source (see StreamSources.hpp). Unlike the
+ * sketches, exact counting has to remember every distinct element: they are copied out of the
+ * chunks into a key store referenced by a FlatDistinctSet, duplicates are not kept. For more
+ * distinct elements than fit in memory, see cardinality_external().
+ *
+ * Memory: the distinct elements (+ 5 bytes per slot, see FlatDistinctSet) + one chunk
+ */
+template <typename source_type>
+inline uint64_t cardinality_stream(source_type &source)
+{
+    using z_type = typename source_type::value_type;
+    std::vector<z_type> K;
+    FlatDistinctSet<z_type> Kprime(K, 0);
+    std::vector<z_type> chunk;
+    while (const size_t n = source.next(chunk, 256))
+    {
+        for (size_t l = 0; l < n; l++)
+        {
+            /* tentatively append, drop again if it was seen */
+            K.push_back(std::move(chunk[l]));
+            if (!Kprime.insert((uint32_t)(K.size() - 1)))
+            {
+                chunk[l] = std::move(K.back()); /* hand the buffer back to the chunk */
+                K.pop_back();
+            }
+        }
+    }
+    return Kprime.size();
+}
+
+
+/**
+ * Cardinality of a pre-aggregated stream: a table of keys K and multiplicities C (see
+ * read_frequencies()), counting the distinct keys with C[i] > 0 (a key may appear in several
+ * rows, e.g. for concatenated tables).
+ */
+template <typename z_type>
+inline uint64_t cardinality_weighted(const std::vector<z_type> &K, const std::vector<uint64_t> &C)
 {
-    int cardinality = 0;
-    std::unordered_set<z_type> Zprime;
-    
-    for (int j = 0; j < (int)Z.size(); j++)
+    FlatDistinctSet<z_type> Kprime(K);
+    for (uint32_t i = 0; i < (uint32_t)K.size(); i++)
     {
-        auto ins = Zprime.insert(Z[j]);
-        if (ins.second == true) cardinality++;
+        if (C[i] > 0)  Kprime.insert(i);
     }
-    return cardinality;
+    return Kprime.size();
 }
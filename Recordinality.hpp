@@ -2,7 +2,16 @@
 
 #include <vector>
 #include <cmath>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <random>
 #include "clhash/clhash.h"
+#include "RecordinalityKernels.hpp"
+#include "StreamSources.hpp"
 
 /**
  * Check if key y is distinct from S[0], ..., S[k_part-1].
@@ -22,6 +31,14 @@ inline int is_distinct(const hash_type *S, int k_part, hash_type y)
     return k_part;
 }
 
+/**
+ * Check if hash value y is distinct from S[0], ..., S[k_part-1] (vectorized, see rec_find()).
+ */
+inline int is_distinct(const uint64_t *S, int k_part, uint64_t y)
+{
+    return (rec_find(S, k_part, y) < 0 ? k_part : -1);
+}
+
 /**
  * Deprecated (performance reasons)
  * Check if key y is distinct from and greater than smallest element in S.
@@ -36,6 +53,8 @@ inline int depr_is_distinct_k_record(const hash_type *S, int k, hash_type y)
 {
     hash_type min = S[0];
     int min_idx = 0;
+    /* every element of S is distinct from y, S[0] included */
+    if (S[0] == y)  return -1;
     for (int i = 1; i < k; i++)
     {
         if (S[i] < min) 
@@ -57,6 +76,21 @@ inline int depr_is_distinct_k_record(const hash_type *S, int k, hash_type y)
     return min_idx;
 }
 
+/**
+ * Check if hash value y is distinct from and greater than smallest element in S (vectorized, see
+ * rec_find() and rec_min2()).
+ */
+inline int depr_is_distinct_k_record(const uint64_t *S, int k, uint64_t y)
+{
+    if (rec_find(S, k, y) >= 0)  return -1;
+    /* y is not in S, so excluding it leaves the minimum of S (if < 2^64-1, else y can't exceed it) */
+    uint64_t min;
+    const int min_idx = rec_min2(S, k, y, min);
+    if (min_idx < 0 || !(y > min))
+        return -1;
+    return min_idx;
+}
+
 
 /* static variable needed in is_distinct_k_record */
 static uint64_t minS; /* invariant: minimum in S */
@@ -66,6 +100,8 @@ static int  minS_idx; /* invariant: index of minimum */
  * Check if key y is distinct from and greater than smallest element in S.
  * (S of positive size k > 0)
  * 
+ * Not reentrant (the minimum is kept in static variables), see RecordinalitySketch instead.
+ * 
  * WEIRD CALLING CONDITIONS(!):
  * - before first call, initialize_minS needs to be called
  * - on every call returning yes, the element at the index returned needs to be consequently 
@@ -84,19 +120,10 @@ int is_distinct_k_record(const uint64_t *S, int k, uint64_t y)
     /* if y is not greater than minimum in S, it has no chance of being a k-record */
     if (y > minS)
     {
-        /* check if y is present in S, alongside find second smallest element in S */
-        uint64_t min2 = 0xffffffff'ffffffff;
-        int  min2_idx = -1;
-        for (int i = 0; i < k; i++)
-        {
-            uint64_t Si = S[i];
-            if (Si < min2 && Si != minS) 
-            {
-                min2 = Si;
-                min2_idx = i;
-            }
-            if (Si == y)  return -1;
-        }
+        /* check if y is present in S, then find second smallest element in S */
+        if (rec_find(S, k, y) >= 0)  return -1;
+        uint64_t min2;
+        const int min2_idx = rec_min2(S, k, minS, min2);
         /* y is distinct k-record: return index of minimum and update static vars minS, minS_idx */
         int ret = minS_idx;
         if (y < min2) {
@@ -136,6 +163,181 @@ void initialize_minS(const uint64_t *S, int k)
 }
 
 
+/**
+ * Recordinality sketch: counts the k-records of the hash values added, i.e. the values that
+ * enter the set S of the k largest distinct values seen so far.
+ * 
+ * Owns its state, so any number of sketches can be used at once (also on different threads).
+ * S is kept as a min-heap next to an open addressing hash set holding the same values, making a
+ * k-record O(log k) and the membership test O(1), instead of the O(k) scan of
+ * is_distinct_k_record(). Values not greater than the minimum of a full S are rejected with a
+ * single compare.
+ * 
+ * Memory: k hash values in the heap + 2k to 4k slots in the hash set
+ */
+class RecordinalitySketch
+{
+public:
+    /**
+     * k        k, positive
+     */
+    explicit RecordinalitySketch(int k)
+        : k_(k), R_(0), shift_(64), zero_in_S_(false)
+    {
+        heap_.reserve(k);
+        size_t slots = 1;
+        while (slots < 2 * (size_t)k)
+        {
+            slots *= 2;
+            shift_--;
+        }
+        T_.assign(slots, 0);
+    }
+
+    int k() const { return k_; }
+    /* number of k-records so far (including the first k distinct values) */
+    int records() const { return R_; }
+    /* the (up to k) largest distinct values seen so far, unordered */
+    const std::vector<uint64_t> &values() const { return heap_; }
+
+    /**
+     * Add hash value y.
+     * 
+     * Return value:
+     * not a k-record   false
+     * yes k-record     true
+     */
+    bool add(uint64_t y)
+    {
+        if ((int)heap_.size() == k_)
+        {
+            /* if y is not greater than minimum in S, it has no chance of being a k-record */
+            if (!(y > heap_[0]) || contains(y))  return false;
+            erase(heap_[0]);
+            std::pop_heap(heap_.begin(), heap_.end(), std::greater<uint64_t>());
+            heap_.back() = y; /* S = S + y - minS */
+        }
+        else
+        {
+            /* fill S with the first k distinct values */
+            if (contains(y))  return false;
+            heap_.push_back(y);
+        }
+        std::push_heap(heap_.begin(), heap_.end(), std::greater<uint64_t>());
+        insert(y);
+        R_++;
+        return true;
+    }
+
+    /**
+     * Add n hash values Y[0], ..., Y[n-1].
+     * 
+     * Once S is full, blocks of 64 values are compared against the minimum of S at once; only
+     * the few values above it go through add(), each re-checked against the minimum as it rises.
+     */
+    void add_batch(const uint64_t *Y, size_t n)
+    {
+        size_t j = 0;
+        for (; j < n && (int)heap_.size() < k_; j++)
+        {
+            add(Y[j]);
+        }
+        for (; j < n; j += 64)
+        {
+            const int block = (int)std::min<size_t>(64, n - j);
+            uint64_t candidates = rec_greater_mask(Y + j, block, heap_[0]);
+            while (candidates != 0)
+            {
+                const uint64_t y = Y[j + __builtin_ctzll(candidates)];
+                candidates &= candidates - 1;
+                if (y > heap_[0])  add(y);
+            }
+        }
+    }
+
+    /**
+     * Recordinality estimate of the number of distinct hash values added so far.
+     */
+    double estimate() const
+    {
+        /* fewer than k distinct values: R counts them exactly */
+        if ((int)heap_.size() < k_)
+            return R_;
+        /* by lecture: return Z := k(1+1/k)^(R-k+1) - 1 */
+        return k_*std::pow(1 + 1./k_, R_-k_+1) - 1;
+    }
+
+private:
+    int k_;
+    int R_;
+    std::vector<uint64_t> heap_; /* S as min-heap */
+    std::vector<uint64_t> T_;    /* S as hash set with linear probing, 0 marks an empty slot */
+    int shift_;                  /* 64 - log(slots) */
+    bool zero_in_S_;             /* 0 can't be stored in T_ */
+
+    size_t slot(uint64_t y) const { return (size_t)((y * 0x9e3779b97f4a7c15) >> shift_ & (T_.size() - 1)); }
+
+    bool contains(uint64_t y) const
+    {
+        if (y == 0)  return zero_in_S_;
+        for (size_t i = slot(y); T_[i] != 0; i = (i + 1) & (T_.size() - 1))
+        {
+            if (T_[i] == y)  return true;
+        }
+        return false;
+    }
+
+    void insert(uint64_t y)
+    {
+        if (y == 0)  { zero_in_S_ = true; return; }
+        size_t i = slot(y);
+        while (T_[i] != 0)  i = (i + 1) & (T_.size() - 1);
+        T_[i] = y;
+    }
+
+    void erase(uint64_t y)
+    {
+        if (y == 0)  { zero_in_S_ = false; return; }
+        const size_t mask = T_.size() - 1;
+        size_t i = slot(y);
+        while (T_[i] != y)  i = (i + 1) & mask;
+        /* backward shift: move later entries of the probe run into the hole if their home slot
+         * isn't between the hole and their position */
+        for (size_t j = (i + 1) & mask; T_[j] != 0; j = (j + 1) & mask)
+        {
+            const size_t home = slot(T_[j]);
+            if (((j - home) & mask) >= ((j - i) & mask))
+            {
+                T_[i] = T_[j];
+                i = j;
+            }
+        }
+        T_[i] = 0;
+    }
+};
+
+
+/**
+ * Recordinality on N hash values, computed in blocks by hash_block(j, n, Y), which stores the
+ * hash values j, ..., j+n-1 in Y[0], ..., Y[n-1] (see rec()).
+ */
+template <typename hash_block_type>
+inline double rec_impl(hash_block_type hash_block, int N, int k)
+{
+    RecordinalitySketch sketch(k);
+    /* compute blocks of hash values and feed them to the batched ingest */
+    constexpr int block = 256;
+    uint64_t Y[block];
+    for (int j = 0; j < N; j += block)
+    {
+        const int n = std::min(block, N - j);
+        hash_block(j, n, Y);
+        sketch.add_batch(Y, n);
+    }
+    return sketch.estimate();
+}
+
+
 /**
  * Recordinality cardinality estimation through k-records.
  * 
@@ -149,42 +351,216 @@ void initialize_minS(const uint64_t *S, int k)
 template <typename z_type>
 inline double rec(clhasher &hash, const std::vector<z_type> &Z, int k)
 {
-    int R = 0, j = 0;
-    uint64_t *S = new uint64_t[k];
+    return rec_impl([&](int j, int n, uint64_t *Y) { hash.hash_many(Z.data() + j, n, Y); }, (int)Z.size(), k);
+}
 
-    /* fill S with the first k distinct elements (hash values) */
-    for (int i = 0; i < k && j < (int)Z.size(); j++)
+
+/**
+ * Recordinality cardinality estimation on precomputed hash values Y[0], ..., Y[n-1]
+ * (see hash_stream()).
+ */
+inline double rec_hashed(const uint64_t *Y, size_t n, int k)
+{
+    RecordinalitySketch sketch(k);
+    sketch.add_batch(Y, n);
+    return sketch.estimate();
+}
+
+
+/**
+ * Recordinality for several k at once: a value is a k-record iff fewer than k distinct larger
+ * values came before it, so the set S of the K = max(k) largest distinct values decides it for
+ * every k <= K. S is kept sorted, giving the rank of a new value by binary search; it counts as
+ * record for all k at least its rank.
+ * 
+ * Estimates are bit-identical to separate RecordinalitySketch runs for every k.
+ * 
+ * Memory: K hash values + 1 counter per k
+ */
+class MultiRecordinalitySketch
+{
+public:
+    /**
+     * k        values of k, positive
+     */
+    explicit MultiRecordinalitySketch(const std::vector<int> &k)
+        : k_(k), R_(k.size(), 0), K_(k.empty() ? 0 : *std::max_element(k.begin(), k.end()))
     {
-        const uint64_t y = hash(Z[j]);
-        if (is_distinct(S, i, y) >= 0)
+        S_.reserve(K_);
+    }
+
+    const std::vector<int> &k() const { return k_; }
+
+    /**
+     * Add hash value y.
+     */
+    void add(uint64_t y)
+    {
+        const bool full = ((int)S_.size() == K_);
+        if (K_ == 0 || (full && !(y > S_[0])))  return;
+        auto pos = std::lower_bound(S_.begin(), S_.end(), y);
+        if (pos != S_.end() && *pos == y)  return;
+
+        /* rank of y: 1 + number of larger values in S */
+        const int rank = (int)(S_.end() - pos) + 1;
+        if (full)
         {
-            R++;
-            S[i] = y;
-            i++;
+            std::move(S_.begin() + 1, pos, S_.begin()); /* S = S + y - minS */
+            *(pos - 1) = y;
+        }
+        else
+        {
+            S_.insert(pos, y);
+        }
+        for (int i = 0; i < (int)k_.size(); i++)
+        {
+            R_[i] += (rank <= k_[i]);
         }
     }
-    if (j == (int)Z.size()) // if already seen whole datastream
-        return R;
 
-    /* count (further) k-records */
-    initialize_minS(S, k);
-    for (; j < (int)Z.size(); j++)
+    /**
+     * Add n hash values Y[0], ..., Y[n-1], pre-filtering blocks of 64 against the minimum of S
+     * once it is full (see RecordinalitySketch::add_batch()).
+     */
+    void add_batch(const uint64_t *Y, size_t n)
     {
-        const uint64_t y = hash(Z[j]);
+        size_t j = 0;
+        for (; j < n && (int)S_.size() < K_; j++)
+        {
+            add(Y[j]);
+        }
+        if (K_ == 0)  return;
+        for (; j < n; j += 64)
+        {
+            const int block = (int)std::min<size_t>(64, n - j);
+            uint64_t candidates = rec_greater_mask(Y + j, block, S_[0]);
+            while (candidates != 0)
+            {
+                const uint64_t y = Y[j + __builtin_ctzll(candidates)];
+                candidates &= candidates - 1;
+                if (y > S_[0])  add(y);
+            }
+        }
+    }
 
-        const int min_idx = is_distinct_k_record(S, k, y);
-        if (min_idx >= 0)
+    /**
+     * Recordinality estimates for every k (in the order given).
+     */
+    std::vector<double> estimates() const
+    {
+        std::vector<double> E(k_.size());
+        for (int i = 0; i < (int)k_.size(); i++)
         {
-            R++;
-            S[min_idx] = y; /* S = S + y - minS */
+            const int k = k_[i], R = R_[i];
+            /* fewer than k distinct values: R counts them exactly */
+            if ((int)S_.size() < k)
+                E[i] = R;
+            else
+                /* by lecture: return Z := k(1+1/k)^(R-k+1) - 1 */
+                E[i] = k*std::pow(1 + 1./k, R-k+1) - 1;
         }
+        return E;
     }
 
-    /* by lecture: return Z := k(1+1/k)^(R-k+1) - 1 */
-    double E = k*std::pow(1 + 1./k, R-k+1) - 1;
+private:
+    std::vector<int> k_;
+    std::vector<int> R_;         /* k-records per k */
+    int K_;                      /* max k */
+    std::vector<uint64_t> S_;    /* K largest distinct values, ascending */
+};
 
-    delete[] S;
-    return E;
+
+/**
+ * Recordinality cardinality estimation through k-records for several k from a single scan.
+ * 
+ * hash     hash function (instance of clhasher struct)
+ * Z        data stream / multiset
+ * k        values of k
+ * 
+ * Memory: max(k) hash values + 1 counter per k
+ */
+template <typename z_type>
+inline std::vector<double> rec(clhasher &hash, const std::vector<z_type> &Z, const std::vector<int> &k)
+{
+    MultiRecordinalitySketch sketch(k);
+    /* hash blocks of the stream and feed them to the batched ingest */
+    constexpr int block = 256;
+    uint64_t Y[block];
+    for (int j = 0; j < (int)Z.size(); j += block)
+    {
+        const int n = std::min(block, (int)Z.size() - j);
+        hash.hash_many(Z.data() + j, n, Y);
+        sketch.add_batch(Y, n);
+    }
+    return sketch.estimates();
+}
+
+
+/**
+ * Recordinality estimates for several k on precomputed hash values Y[0], ..., Y[n-1]
+ * (see hash_stream()).
+ */
+inline std::vector<double> rec_hashed(const uint64_t *Y, size_t n, const std::vector<int> &k)
+{
+    MultiRecordinalitySketch sketch(k);
+    sketch.add_batch(Y, n);
+    return sketch.estimates();
+}
+
+
+/**
+ * Recordinality cardinality estimation through k-records on a pull source (see
+ * StreamSources.hpp), read once, chunk by chunk; same estimates as rec() on the whole stream.
+ * 
+ * hash     hash function (instance of clhasher struct)
+ * source   pull source of the data stream / multiset
+ * k        k, or values of k (one estimate each)
+ * 
+ * Memory: max(k) hash values + one chunk, independent of the stream length
+ */
+template <typename source_type>
+inline double rec_stream(clhasher &hash, source_type &source, int k)
+{
+    RecordinalitySketch sketch(k);
+    hash_source(hash, source, [&](const uint64_t *Y, size_t n) { sketch.add_batch(Y, n); });
+    return sketch.estimate();
+}
+
+template <typename source_type>
+inline std::vector<double> rec_stream(clhasher &hash, source_type &source, const std::vector<int> &k)
+{
+    MultiRecordinalitySketch sketch(k);
+    hash_source(hash, source, [&](const uint64_t *Y, size_t n) { sketch.add_batch(Y, n); });
+    return sketch.estimates();
+}
+
+
+/**
+ * Recordinality cardinality estimation through k-records on a pre-aggregated stream: a table of
+ * keys K and multiplicities C (see read_frequencies()). Repetitions are never k-records, so only
+ * the order of the first occurrences matters, which the table stands in for: every key with
+ * C[i] > 0 is taken once, in table order. The hash values are random and independent of that
+ * order, so the estimate has the same distribution as rec() on the stream; it is the same
+ * estimate if the table lists the keys in order of first occurrence.
+ * 
+ * hash     hash function (instance of clhasher struct)
+ * K        keys
+ * C        multiplicities, C[i] of K[i]
+ * k        k, or values of k (one estimate each)
+ */
+template <typename z_type>
+inline double rec_weighted(clhasher &hash, const std::vector<z_type> &K, const std::vector<uint64_t> &C, int k)
+{
+    FrequencySource<z_type> source(K, C);
+    return rec_stream(hash, source, k);
+}
+
+template <typename z_type>
+inline std::vector<double> rec_weighted(clhasher &hash, const std::vector<z_type> &K, const std::vector<uint64_t> &C,
+                                        const std::vector<int> &k)
+{
+    FrequencySource<z_type> source(K, C);
+    return rec_stream(hash, source, k);
 }
 
 
@@ -238,3 +614,179 @@ inline double rec_nohash(const std::vector<z_type> &Z, int k)
     delete[] S;
     return E;
 }
+
+
+/**
+ * Key of rec_nohash() over strings: a view into the stream plus its first 8 bytes as big endian
+ * integer (zero padded), which orders like the strings wherever two prefixes differ.
+ */
+struct rec_string_key
+{
+    uint64_t prefix;
+    std::string_view str;
+
+    explicit rec_string_key(std::string_view s) : str(s)
+    {
+        unsigned char buf[8] = {};
+        std::memcpy(buf, s.data(), std::min<size_t>(8, s.size()));
+        uint64_t p;
+        std::memcpy(&p, buf, 8);
+        prefix = __builtin_bswap64(p);
+    }
+
+    bool operator<(const rec_string_key &other) const
+    {
+        if (prefix != other.prefix)  return prefix < other.prefix;
+        return str < other.str;
+    }
+    bool operator==(const rec_string_key &other) const
+    {
+        return prefix == other.prefix && str == other.str;
+    }
+};
+
+/**
+ * Recordinality without hash function on the strings str_at(0), ..., str_at(N-1), which need to
+ * outlive the call (see rec_nohash()).
+ *
+ * S is kept sorted in one buffer of k keys: the minimum is S[0], membership is a binary search
+ * (mostly deciding on the prefixes), and a k-record shifts the keys below its position down by
+ * one, dropping the minimum. Nothing is copied or allocated per element.
+ */
+template <typename str_at_type>
+inline double rec_nohash_impl(str_at_type str_at, int N, int k)
+{
+    int R = 0, j = 0;
+    std::vector<rec_string_key> S;
+    S.reserve(k);
+
+    /* fill S with the first k distinct elements */
+    for (; (int)S.size() < k && j < N; j++)
+    {
+        const rec_string_key y(str_at(j));
+        const auto pos = std::lower_bound(S.begin(), S.end(), y);
+        if (pos == S.end() || !(*pos == y))
+        {
+            R++;
+            S.insert(pos, y);
+        }
+    }
+    if (j == N) // if already seen whole datastream
+        return R;
+
+    /* count (further) k-records */
+    for (; j < N; j++)
+    {
+        const rec_string_key y(str_at(j));
+        /* if y is not greater than minimum in S, it has no chance of being a k-record */
+        if (!(S[0] < y))  continue;
+        const auto pos = std::lower_bound(S.begin() + 1, S.end(), y);
+        if (pos != S.end() && *pos == y)  continue;
+
+        R++;
+        std::move(S.begin() + 1, pos, S.begin()); /* S = S + y - minS */
+        *(pos - 1) = y;
+    }
+
+    /* by lecture: return Z := k(1+1/k)^(R-k+1) - 1 */
+    return k*std::pow(1 + 1./k, R-k+1) - 1;
+}
+
+/**
+ * Recordinality without hash function on a stream of strings (see rec_nohash()), comparing
+ * views into Z instead of copies.
+ */
+inline double rec_nohash(const std::vector<std::string> &Z, int k)
+{
+    return rec_nohash_impl([&](int j) { return std::string_view(Z[j]); }, (int)Z.size(), k);
+}
+
+/**
+ * Recordinality without hash function on a stream of string views (see rec_nohash()).
+ */
+inline double rec_nohash(const std::vector<std::string_view> &Z, int k)
+{
+    return rec_nohash_impl([&](int j) { return Z[j]; }, (int)Z.size(), k);
+}
+
+
+/**
+ * Recordinality without hash function on a pull source (see StreamSources.hpp), e.g. the words
+ * of a file. The elements of a chunk don't outlive it, so S holds copies of its k elements,
+ * kept sorted as in rec_nohash_impl(); the k-records and estimate are those of rec_nohash().
+ *
+ * source   pull source of the data stream / multiset
+ * k        k
+ *
+ * Memory: k elements + one chunk, independent of the stream length
+ */
+template <typename source_type>
+inline double rec_nohash_stream(source_type &source, int k)
+{
+    using z_type = typename source_type::value_type;
+    int R = 0;
+    std::vector<z_type> S;
+    S.reserve(k);
+
+    std::vector<z_type> chunk;
+    while (const size_t n = source.next(chunk, 256))
+    {
+        for (size_t l = 0; l < n; l++)
+        {
+            z_type &y = chunk[l];
+            if ((int)S.size() < k)
+            {
+                /* fill S with the first k distinct elements */
+                const auto pos = std::lower_bound(S.begin(), S.end(), y);
+                if (pos == S.end() || !(*pos == y))
+                {
+                    R++;
+                    S.insert(pos, std::move(y));
+                }
+                continue;
+            }
+            /* if y is not greater than minimum in S, it has no chance of being a k-record */
+            if (!(S[0] < y))  continue;
+            const auto pos = std::lower_bound(S.begin() + 1, S.end(), y);
+            if (pos != S.end() && *pos == y)  continue;
+
+            R++;
+            /* S = S + y - minS, moving the minimum's buffer into the chunk for reuse */
+            std::swap(S[0], y);
+            std::rotate(S.begin(), S.begin() + 1, pos);
+        }
+    }
+    if ((int)S.size() < k) // if fewer than k distinct elements in the whole datastream
+        return R;
+
+    /* by lecture: return Z := k(1+1/k)^(R-k+1) - 1 */
+    return k*std::pow(1 + 1./k, R-k+1) - 1;
+}
+
+
+/**
+ * Recordinality without hash function on a pre-aggregated stream: a table of keys K and
+ * multiplicities C (see read_frequencies()). Without a hash function, the order of the first
+ * occurrences is the only source of randomness, and a table doesn't keep it (the .dat files are
+ * sorted, making every key a record). The keys with C[i] > 0 are taken once each in a random
+ * order drawn from seed instead, as in a stream whose distinct keys first appear in random order.
+ *
+ * K        keys
+ * C        multiplicities, C[i] of K[i]
+ * k        k
+ * seed     seed of the order
+ */
+template <typename z_type>
+inline double rec_nohash_weighted(const std::vector<z_type> &K, const std::vector<uint64_t> &C, int k, uint64_t seed)
+{
+    std::vector<uint32_t> order;
+    for (uint32_t i = 0; i < (uint32_t)K.size(); i++)
+    {
+        if (C[i] > 0)  order.push_back(i);
+    }
+    std::mt19937_64 rng(seed);
+    std::shuffle(order.begin(), order.end(), rng);
+    size_t next = 0;
+    auto source = generator_source([&]() -> const z_type & { return K[order[next++]]; }, order.size());
+    return rec_nohash_stream(source, k);
+}
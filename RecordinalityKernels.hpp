@@ -0,0 +1,261 @@
+#pragma once
+
+#include <cstdint>
+#include <immintrin.h>
+
+/*
+ * Scans over the k-record set S of Recordinality: membership of a hash value and the smallest
+ * element apart from a given one (the second minimum, when excluding the minimum), and the
+ * pre-filter of incoming hash values against the minimum of S.
+ *
+ * Every kernel has a scalar version and, if compiled with AVX2 resp. AVX-512 support (e.g.
+ * -march=native in Release), vector versions comparing 4 resp. 8 elements at once. They use
+ * unaligned loads and finish the last n mod 4 (8) elements with the scalar version, so S needs
+ * no alignment or padding. The unsuffixed functions dispatch to the best available one; all
+ * versions return the same result.
+ *
+ * rec_find() and rec_min2() do the scans of rec_nohash() on 64 bit values (is_distinct(),
+ * depr_is_distinct_k_record(), is_distinct_k_record()), rec_greater_mask() the pre-filter of
+ * the sketches' add_batch().
+ */
+
+/**
+ * Index of the first S[i] == y, -1 if y is not in S[0], ..., S[n-1].
+ */
+inline int rec_find_scalar(const uint64_t *S, int n, uint64_t y)
+{
+    for (int i = 0; i < n; i++)
+    {
+        if (S[i] == y)  return i;
+    }
+    return -1;
+}
+
+/**
+ * Index of the first smallest S[i] != exclude with S[i] < 2^64-1, stored in min;
+ * -1 (and min = 2^64-1) if there is none.
+ */
+inline int rec_min2_scalar(const uint64_t *S, int n, uint64_t exclude, uint64_t &min)
+{
+    min = 0xffffffff'ffffffff;
+    int min_idx = -1;
+    for (int i = 0; i < n; i++)
+    {
+        if (S[i] < min && S[i] != exclude)
+        {
+            min = S[i];
+            min_idx = i;
+        }
+    }
+    return min_idx;
+}
+
+/**
+ * Bit i set iff Y[i] > threshold, for i < n <= 64.
+ */
+inline uint64_t rec_greater_mask_scalar(const uint64_t *Y, int n, uint64_t threshold)
+{
+    uint64_t mask = 0;
+    for (int i = 0; i < n; i++)
+    {
+        mask |= (uint64_t)(Y[i] > threshold) << i;
+    }
+    return mask;
+}
+
+/**
+ * Fold the per lane minima and their indices into min, min_idx, preferring the first index
+ * on equal values (as the scalar scan does).
+ */
+inline int rec_min2_reduce(const uint64_t *lane_min, const int64_t *lane_idx, int lanes, uint64_t &min)
+{
+    min = 0xffffffff'ffffffff;
+    int min_idx = -1;
+    for (int l = 0; l < lanes; l++)
+    {
+        if (lane_idx[l] < 0)  continue;
+        if (lane_min[l] < min || (lane_min[l] == min && lane_idx[l] < min_idx))
+        {
+            min = lane_min[l];
+            min_idx = (int)lane_idx[l];
+        }
+    }
+    return min_idx;
+}
+
+
+#ifdef __AVX2__
+inline int rec_find_avx2(const uint64_t *S, int n, uint64_t y)
+{
+    const __m256i vy = _mm256_set1_epi64x((long long)y);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)(S + i)), vy);
+        const int bits = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        if (bits != 0)  return i + __builtin_ctz(bits);
+    }
+    const int tail = rec_find_scalar(S + i, n - i, y);
+    return tail < 0 ? -1 : i + tail;
+}
+
+/**
+ * AVX2 only compares signed 64 bit integers: flipping the sign bit of both sides turns that
+ * into the unsigned order.
+ */
+inline int rec_min2_avx2(const uint64_t *S, int n, uint64_t exclude, uint64_t &min)
+{
+    const __m256i sign = _mm256_set1_epi64x((long long)0x80000000'00000000);
+    const __m256i vexclude = _mm256_set1_epi64x((long long)exclude);
+    __m256i vmin = _mm256_set1_epi64x(0x7fffffff'ffffffff); /* 2^64-1 with flipped sign bit */
+    __m256i vidx = _mm256_set1_epi64x(-1);
+    __m256i idx = _mm256_setr_epi64x(0, 1, 2, 3);
+    const __m256i four = _mm256_set1_epi64x(4);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m256i s = _mm256_loadu_si256((const __m256i *)(S + i));
+        const __m256i v = _mm256_xor_si256(s, sign);
+        const __m256i smaller = _mm256_andnot_si256(_mm256_cmpeq_epi64(s, vexclude), _mm256_cmpgt_epi64(vmin, v));
+        vmin = _mm256_blendv_epi8(vmin, v, smaller);
+        vidx = _mm256_blendv_epi8(vidx, idx, smaller);
+        idx = _mm256_add_epi64(idx, four);
+    }
+    uint64_t lane_min[4];
+    int64_t lane_idx[4];
+    _mm256_storeu_si256((__m256i *)lane_min, _mm256_xor_si256(vmin, sign));
+    _mm256_storeu_si256((__m256i *)lane_idx, vidx);
+    int min_idx = rec_min2_reduce(lane_min, lane_idx, 4, min);
+
+    /* the tail comes after every vector element, so only strictly smaller values replace min */
+    uint64_t tail_min;
+    const int tail = rec_min2_scalar(S + i, n - i, exclude, tail_min);
+    if (tail >= 0 && tail_min < min)
+    {
+        min = tail_min;
+        min_idx = i + tail;
+    }
+    return min_idx;
+}
+
+inline uint64_t rec_greater_mask_avx2(const uint64_t *Y, int n, uint64_t threshold)
+{
+    const __m256i sign = _mm256_set1_epi64x((long long)0x80000000'00000000);
+    const __m256i vt = _mm256_xor_si256(_mm256_set1_epi64x((long long)threshold), sign);
+    uint64_t mask = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(Y + i)), sign);
+        const __m256i gt = _mm256_cmpgt_epi64(v, vt);
+        mask |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(gt)) << i;
+    }
+    if (i < n)  mask |= rec_greater_mask_scalar(Y + i, n - i, threshold) << i;
+    return mask;
+}
+#endif
+
+
+#ifdef __AVX512F__
+inline int rec_find_avx512(const uint64_t *S, int n, uint64_t y)
+{
+    const __m512i vy = _mm512_set1_epi64((long long)y);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __mmask8 eq = _mm512_cmpeq_epu64_mask(_mm512_loadu_si512((const void *)(S + i)), vy);
+        if (eq != 0)  return i + __builtin_ctz(eq);
+    }
+    const int tail = rec_find_scalar(S + i, n - i, y);
+    return tail < 0 ? -1 : i + tail;
+}
+
+inline int rec_min2_avx512(const uint64_t *S, int n, uint64_t exclude, uint64_t &min)
+{
+    const __m512i vexclude = _mm512_set1_epi64((long long)exclude);
+    __m512i vmin = _mm512_set1_epi64(-1);
+    __m512i vidx = _mm512_set1_epi64(-1);
+    __m512i idx = _mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m512i eight = _mm512_set1_epi64(8);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m512i s = _mm512_loadu_si512((const void *)(S + i));
+        const __mmask8 smaller = _mm512_mask_cmplt_epu64_mask(_mm512_cmpneq_epu64_mask(s, vexclude), s, vmin);
+        vmin = _mm512_mask_mov_epi64(vmin, smaller, s);
+        vidx = _mm512_mask_mov_epi64(vidx, smaller, idx);
+        idx = _mm512_add_epi64(idx, eight);
+    }
+    uint64_t lane_min[8];
+    int64_t lane_idx[8];
+    _mm512_storeu_si512((void *)lane_min, vmin);
+    _mm512_storeu_si512((void *)lane_idx, vidx);
+    int min_idx = rec_min2_reduce(lane_min, lane_idx, 8, min);
+
+    uint64_t tail_min;
+    const int tail = rec_min2_scalar(S + i, n - i, exclude, tail_min);
+    if (tail >= 0 && tail_min < min)
+    {
+        min = tail_min;
+        min_idx = i + tail;
+    }
+    return min_idx;
+}
+
+inline uint64_t rec_greater_mask_avx512(const uint64_t *Y, int n, uint64_t threshold)
+{
+    const __m512i vt = _mm512_set1_epi64((long long)threshold);
+    uint64_t mask = 0;
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __mmask8 gt = _mm512_cmpgt_epu64_mask(_mm512_loadu_si512((const void *)(Y + i)), vt);
+        mask |= (uint64_t)gt << i;
+    }
+    if (i < n)  mask |= rec_greater_mask_scalar(Y + i, n - i, threshold) << i;
+    return mask;
+}
+#endif
+
+
+/**
+ * Index of the first S[i] == y, -1 if y is not in S (see rec_find_scalar()).
+ */
+inline int rec_find(const uint64_t *S, int n, uint64_t y)
+{
+#if defined(__AVX512F__)
+    return rec_find_avx512(S, n, y);
+#elif defined(__AVX2__)
+    return rec_find_avx2(S, n, y);
+#else
+    return rec_find_scalar(S, n, y);
+#endif
+}
+
+/**
+ * Index of the smallest S[i] != exclude, stored in min (see rec_min2_scalar()).
+ */
+inline int rec_min2(const uint64_t *S, int n, uint64_t exclude, uint64_t &min)
+{
+#if defined(__AVX512F__)
+    return rec_min2_avx512(S, n, exclude, min);
+#elif defined(__AVX2__)
+    return rec_min2_avx2(S, n, exclude, min);
+#else
+    return rec_min2_scalar(S, n, exclude, min);
+#endif
+}
+
+/**
+ * Bit i set iff Y[i] > threshold, for i < n <= 64 (see rec_greater_mask_scalar()).
+ */
+inline uint64_t rec_greater_mask(const uint64_t *Y, int n, uint64_t threshold)
+{
+#if defined(__AVX512F__)
+    return rec_greater_mask_avx512(Y, n, threshold);
+#elif defined(__AVX2__)
+    return rec_greater_mask_avx2(Y, n, threshold);
+#else
+    return rec_greater_mask_scalar(Y, n, threshold);
+#endif
+}
@@ -0,0 +1,449 @@
+#pragma once
+
+#include "HyperLogLog.hpp"
+#include "HyperLogLogPacked.hpp"
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Sketch store file format (native byte order), version 1:
+ *
+ * header   64 bytes, see sketch_store_header
+ * index    2*capacity entries {key, record + 1} of an open addressing (linear probing) hash
+ *          table from key to record number, record + 1 == 0 marks an empty entry
+ * records  capacity records of record_size bytes, the registers of one HLL sketch each
+ *
+ * Register layouts:
+ * bytes8   m registers of 8 bits (as HyperLogLogSketch)
+ * packed6  m registers of 6 bits, 10 per 64 bit word (ranks are <= 64 - logm <= 63 for logm > 0)
+ *
+ * The file is used through mmap: lookups, estimates, updates and merges work directly on the
+ * mapped bytes. When all records are in use, the file is rewritten with twice the capacity.
+ */
+
+struct sketch_store_header
+{
+    char magic[8];          /* "HLLSTORE" */
+    uint32_t version;
+    uint32_t logm;
+    uint32_t layout;        /* SketchStore::layout */
+    uint32_t record_size;   /* bytes per record */
+    uint64_t num_keys;
+    uint64_t capacity;      /* number of records, the index has 2*capacity entries */
+    uint8_t reserved[24];
+};
+static_assert(sizeof(sketch_store_header) == 64, "Sketch store header must be 64 bytes.");
+
+struct sketch_store_entry
+{
+    uint64_t key;
+    uint64_t record_plus_one;
+};
+
+
+/**
+ * Persistent store of per-key HyperLogLog sketches (all with m = 2^(logm) registers), in a
+ * memory-mapped file.
+ *
+ * Like clhasher, owns OS resources --> do not copy.
+ */
+class SketchStore
+{
+public:
+    enum layout : uint32_t { bytes8 = 0, packed6 = 1 };
+    static constexpr uint32_t version = 1;
+
+    /**
+     * Create a new store at path (an existing file is overwritten).
+     *
+     * logm         log(m), 1 to 30
+     * reg_layout   register layout of the records
+     * capacity     initial number of records (rounded up to a power of two, as the index needs)
+     */
+    SketchStore(const std::string &path, int logm, layout reg_layout, uint64_t capacity = 64)
+        : path_(path)
+    {
+        assert(logm > 0 && logm <= 30 && capacity > 0);
+        uint64_t pow2_capacity = 1;
+        while (pow2_capacity < capacity)  pow2_capacity *= 2;
+        sketch_store_header h = make_header(logm, reg_layout, pow2_capacity);
+        create_file(path_, h);
+        open_file();
+    }
+
+    /**
+     * Open an existing store at path.
+     */
+    explicit SketchStore(const std::string &path)
+        : path_(path)
+    {
+        open_file();
+        if (!is_valid(header(), size_))
+        {
+            close_file();
+            std::cerr << "Not a sketch store file (or unsupported version)!\n";
+            throw;
+        }
+    }
+
+    SketchStore(const SketchStore &) = delete;
+    SketchStore &operator=(const SketchStore &) = delete;
+
+    ~SketchStore()
+    {
+        close_file();
+    }
+
+    int logm() const { return (int)header().logm; }
+    int m() const { return uiexp2<int>(logm()); }
+    layout reg_layout() const { return (layout)header().layout; }
+    uint64_t size() const { return header().num_keys; }
+    uint64_t capacity() const { return header().capacity; }
+    size_t file_size() const { return size_; }
+
+    bool contains(uint64_t key) const { return find(key) != nullptr; }
+
+    /**
+     * All keys in the store (in index order).
+     */
+    std::vector<uint64_t> keys() const
+    {
+        std::vector<uint64_t> K;
+        const sketch_store_entry *I = index();
+        for (uint64_t i = 0; i < 2*capacity(); i++)
+        {
+            if (I[i].record_plus_one != 0)  K.push_back(I[i].key);
+        }
+        return K;
+    }
+
+    /**
+     * Add hash values Y[0], ..., Y[n-1] to the sketch of key (created empty if new).
+     */
+    void add(uint64_t key, const uint64_t *Y, size_t n)
+    {
+        uint8_t *rec = find_or_insert(key);
+        const uint64_t mask = m() - 1;
+        if (reg_layout() == bytes8)
+        {
+            hll_update(rec, mask, Y, n);
+            return;
+        }
+        uint64_t *W = (uint64_t *)rec;
+        for (size_t j = 0; j < n; j++)
+        {
+            const uint64_t y = Y[j];
+            if ((y & ~mask) == 0) {std::cerr<<"HLL FAILURE: Not enough bits in hash!\n"; throw;}
+            packed6_update(W, (int)(y & mask), (uint8_t)(lzcnt(y) + 1));
+        }
+    }
+
+    void add(uint64_t key, uint64_t y) { add(key, &y, 1); }
+
+    /**
+     * Merge sketch into the sketch of key (created empty if new).
+     */
+    void merge(uint64_t key, const HyperLogLogSketch &sketch)
+    {
+        assert(sketch.logm() == logm() && "Can only merge sketches with equal m.");
+        uint8_t *rec = find_or_insert(key);
+        const uint8_t *R = sketch.registers();
+        if (reg_layout() == bytes8)
+        {
+            for (int k = 0; k < m(); k++)
+            {
+                rec[k] = std::max(rec[k], R[k]);
+            }
+            return;
+        }
+        for (int k = 0; k < m(); k++)
+        {
+            packed6_update((uint64_t *)rec, k, R[k]);
+        }
+    }
+
+    /**
+     * Merge the sketch of key_src into the sketch of key (created empty if new).
+     */
+    void merge(uint64_t key, uint64_t key_src)
+    {
+        if (find(key_src) == nullptr)  return;
+        uint8_t *rec = find_or_insert(key); /* may remap the file --> look up key_src afterwards */
+        const uint8_t *src = find(key_src);
+        if (reg_layout() == bytes8)
+        {
+            for (int k = 0; k < m(); k++)
+            {
+                rec[k] = std::max(rec[k], src[k]);
+            }
+            return;
+        }
+        uint64_t *W = (uint64_t *)rec;
+        const uint64_t *W_src = (const uint64_t *)src;
+        for (uint32_t w = 0; w < header().record_size / sizeof(uint64_t); w++)
+        {
+            W[w] = hll_packing<6>::max(W[w], W_src[w]);
+        }
+    }
+
+    /**
+     * Raw HLL estimate for key (0 for unknown keys).
+     */
+    double estimate(uint64_t key) const
+    {
+        const uint8_t *rec = find(key);
+        if (rec == nullptr)  return 0.0;
+
+        const int m = this->m();
+        /* by FlFuGaMe07: compute Z := ( sum_ 2^(-R[k]) )^-1 */
+        hll_inverse_sum sum;
+        if (reg_layout() == bytes8)
+            sum.add(rec, m);
+        else
+        {
+            constexpr int block = 16 * hll_packing<6>::per_word;
+            uint8_t R[block];
+            for (int k = 0; k < m; k += block)
+            {
+                const int n = std::min(block, m - k);
+                packed6_decode((const uint64_t *)rec, R, k, n);
+                sum.add(R, n);
+            }
+        }
+        double E = 1./sum.result();
+        /* by FlFuGaMe07: "raw" HLL estimate: E := alpha_m * m^2 * Z */
+        E = alpha(m) * m*m * E;
+        /* note that we're not doing small/large range corrections */
+        return E;
+    }
+
+    /**
+     * Copy of the sketch of key (empty for unknown keys).
+     */
+    HyperLogLogSketch sketch(uint64_t key) const
+    {
+        HyperLogLogSketch S(logm());
+        const uint8_t *rec = find(key);
+        if (rec == nullptr)  return S;
+        std::vector<uint8_t> R(m());
+        if (reg_layout() == bytes8)
+            std::memcpy(R.data(), rec, m());
+        else
+            packed6_decode((const uint64_t *)rec, R.data(), 0, m());
+        for (int k = 0; k < m(); k++)
+        {
+            S.update(k, R[k]);
+        }
+        return S;
+    }
+
+    /**
+     * Flush the mapped pages to the file.
+     */
+    void sync()
+    {
+        msync(data_, size_, MS_SYNC);
+    }
+
+private:
+    std::string path_;
+    int fd_ = -1;
+    uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+
+    const sketch_store_header &header() const { return *(const sketch_store_header *)data_; }
+    sketch_store_header &header() { return *(sketch_store_header *)data_; }
+    const sketch_store_entry *index() const { return (const sketch_store_entry *)(data_ + sizeof(sketch_store_header)); }
+    sketch_store_entry *index() { return (sketch_store_entry *)(data_ + sizeof(sketch_store_header)); }
+
+    static size_t file_size_for(const sketch_store_header &h)
+    {
+        return sizeof(sketch_store_header) + 2*h.capacity*sizeof(sketch_store_entry) + h.capacity*h.record_size;
+    }
+
+    /**
+     * Check header h of a file of file_size bytes before anything is indexed through it: magic
+     * and version, logm with m() an int, a known layout with its record size, a power of two
+     * capacity, at most capacity keys, and the file size these imply.
+     */
+    static bool is_valid(const sketch_store_header &h, size_t file_size)
+    {
+        if (std::memcmp(h.magic, "HLLSTORE", 8) != 0 || h.version != version)  return false;
+        if (h.logm == 0 || h.logm > 30 || (h.layout != bytes8 && h.layout != packed6))  return false;
+        if (h.record_size != make_header((int)h.logm, (layout)h.layout, 1).record_size)  return false;
+        if (h.capacity == 0 || (h.capacity & (h.capacity - 1)) != 0 || h.num_keys > h.capacity)  return false;
+        /* bound the capacity first, so the size computation can't overflow */
+        if (h.capacity > file_size / h.record_size)  return false;
+        return file_size == file_size_for(h);
+    }
+
+    static sketch_store_header make_header(int logm, layout reg_layout, uint64_t capacity)
+    {
+        sketch_store_header h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, "HLLSTORE", 8);
+        h.version = version;
+        h.logm = logm;
+        h.layout = reg_layout;
+        const uint64_t m = uiexp2<uint64_t>(logm);
+        const uint64_t words = (reg_layout == bytes8) ? (m + 7) / 8 : (m + hll_packing<6>::per_word - 1) / hll_packing<6>::per_word;
+        h.record_size = (uint32_t)(words * sizeof(uint64_t));
+        h.num_keys = 0;
+        h.capacity = capacity;
+        return h;
+    }
+
+    /**
+     * Write an empty store with header h (index and records zeroed) to path.
+     */
+    static void create_file(const std::string &path, const sketch_store_header &h)
+    {
+        const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ftruncate(fd, file_size_for(h)) != 0 || pwrite(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h))
+        {
+            if (fd >= 0)  ::close(fd);
+            std::cerr << "Couldn't create sketch store file!\n";
+            throw;
+        }
+        ::close(fd);
+    }
+
+    void open_file()
+    {
+        fd_ = ::open(path_.c_str(), O_RDWR);
+        struct stat st;
+        if (fd_ < 0 || fstat(fd_, &st) != 0 || (size_t)st.st_size < sizeof(sketch_store_header))
+        {
+            close_file();
+            std::cerr << "Couldn't open sketch store file!\n";
+            throw;
+        }
+        size_ = st.st_size;
+        void *p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED)
+        {
+            close_file();
+            std::cerr << "Couldn't map sketch store file!\n";
+            throw;
+        }
+        data_ = (uint8_t *)p;
+    }
+
+    void close_file()
+    {
+        if (data_ != nullptr)  munmap(data_, size_);
+        if (fd_ >= 0)  ::close(fd_);
+        data_ = nullptr;
+        fd_ = -1;
+    }
+
+    uint64_t slot(uint64_t key) const
+    {
+        /* Fibonacci hashing, the index has a power of two number of entries */
+        return (key * 0x9e3779b97f4a7c15ULL) & (2*capacity() - 1);
+    }
+
+    uint8_t *record(uint64_t r) const
+    {
+        return data_ + sizeof(sketch_store_header) + 2*capacity()*sizeof(sketch_store_entry) + r*header().record_size;
+    }
+
+    /**
+     * Registers of key, nullptr if unknown.
+     */
+    uint8_t *find(uint64_t key) const
+    {
+        const sketch_store_entry *I = index();
+        const uint64_t mask = 2*capacity() - 1;
+        for (uint64_t i = slot(key); I[i].record_plus_one != 0; i = (i + 1) & mask)
+        {
+            if (I[i].key == key)  return record(I[i].record_plus_one - 1);
+        }
+        return nullptr;
+    }
+
+    /**
+     * Registers of key, appending an empty record (and growing the file) if unknown.
+     */
+    uint8_t *find_or_insert(uint64_t key)
+    {
+        uint8_t *rec = find(key);
+        if (rec != nullptr)  return rec;
+        if (size() == capacity())  grow();
+
+        sketch_store_entry *I = index();
+        const uint64_t mask = 2*capacity() - 1;
+        uint64_t i = slot(key);
+        while (I[i].record_plus_one != 0)  i = (i + 1) & mask;
+        const uint64_t r = header().num_keys++;
+        I[i].key = key;
+        I[i].record_plus_one = r + 1;
+        return record(r);
+    }
+
+    /**
+     * Rewrite the store with twice the capacity (records keep their numbers).
+     */
+    void grow()
+    {
+        sketch_store_header h = header();
+        h.capacity *= 2;
+        const std::string tmp_path = path_ + ".tmp";
+        create_file(tmp_path, h);
+        {
+            SketchStore grown(tmp_path);
+            std::memcpy(grown.record(0), record(0), size()*h.record_size);
+            const sketch_store_entry *I = index();
+            sketch_store_entry *I_grown = grown.index();
+            const uint64_t mask = 2*h.capacity - 1;
+            for (uint64_t i = 0; i < 2*capacity(); i++)
+            {
+                if (I[i].record_plus_one == 0)  continue;
+                uint64_t j = grown.slot(I[i].key);
+                while (I_grown[j].record_plus_one != 0)  j = (j + 1) & mask;
+                I_grown[j] = I[i];
+            }
+            grown.header().num_keys = size();
+        }
+        close_file();
+        if (std::rename(tmp_path.c_str(), path_.c_str()) != 0)
+        {
+            std::cerr << "Couldn't replace sketch store file!\n";
+            throw;
+        }
+        open_file();
+    }
+
+    /**
+     * R[k] = max(R[k], p) on 6 bit registers packed into words W.
+     */
+    static void packed6_update(uint64_t *W, int k, uint8_t p)
+    {
+        using packing = hll_packing<6>;
+        uint64_t &w = W[k / packing::per_word];
+        const int shift = (k % packing::per_word) * 6;
+        if (p > ((w >> shift) & packing::field))
+            w = (w & ~(packing::field << shift)) | ((uint64_t)p << shift);
+    }
+
+    /**
+     * Write 6 bit registers k0, ..., k0+n-1 from words W to R.
+     */
+    static void packed6_decode(const uint64_t *W, uint8_t *R, int k0, int n)
+    {
+        using packing = hll_packing<6>;
+        for (int i = 0; i < n; i++)
+        {
+            const int k = k0 + i;
+            R[i] = (uint8_t)((W[k / packing::per_word] >> ((k % packing::per_word) * 6)) & packing::field);
+        }
+    }
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "HyperLogLog.hpp"
+#include <vector>
+#include <cstdint>
+#include <cassert>
+
+/**
+ * Sliding window HyperLogLog (FuNi10, "List of Future Possible Maxima"): estimates the number
+ * of distinct hash values with a timestamp in (now - window, now] for any window up to a
+ * maximum, without keeping or rescanning the stream.
+ *
+ * Every register keeps the (timestamp, rank) pairs that can still become its maximum for some
+ * window: a pair is dropped as soon as a later pair has a rank at least as high, or once it is
+ * older than the maximum window. Pairs are ordered by timestamp with strictly decreasing ranks,
+ * so the register value for a window is the rank of its oldest pair inside the window.
+ *
+ * Timestamps must be non-decreasing and < 2^56 (e.g. seconds, or the position in the stream).
+ *
+ * Memory: 8 bytes per kept pair (expected O(log(n_window/m)) per register) plus the list
+ *         headers, vs. 1 byte per register for HyperLogLogSketch
+ */
+class SlidingHyperLogLogSketch
+{
+public:
+    /**
+     * logm         log(m), non-negative
+     * max_window   longest window that can be queried
+     */
+    SlidingHyperLogLogSketch(int logm, uint64_t max_window)
+        : logm_(logm), mask_(uiexp2<uint64_t>(logm) - 1), max_window_(max_window), L_(uiexp2<size_t>(logm))
+    {}
+
+    int logm() const { return logm_; }
+    int m() const { return (int)(mask_ + 1); }
+    uint64_t max_window() const { return max_window_; }
+
+    /**
+     * Bytes used by the lists of pairs (including their headers).
+     */
+    size_t memory() const
+    {
+        size_t bytes = L_.size() * sizeof(L_[0]);
+        for (const auto &L : L_)
+        {
+            bytes += L.capacity() * sizeof(uint64_t);
+        }
+        return bytes;
+    }
+
+    /**
+     * Number of kept (timestamp, rank) pairs.
+     */
+    size_t num_pairs() const
+    {
+        size_t n = 0;
+        for (const auto &L : L_)
+        {
+            n += L.size();
+        }
+        return n;
+    }
+
+    /**
+     * Add hash value y seen at time t: the lower logm bits select the register, the remaining
+     * bits the rank.
+     */
+    void add(uint64_t y, uint64_t t)
+    {
+        const uint64_t y_up  = (y & mask_);
+        const uint64_t y_low = (y & ~mask_);
+        if (y_low == 0) {std::cerr<<"HLL FAILURE: Not enough bits in hash!\n"; throw;}
+        assert(t < uiexp2<uint64_t>(56) && "Timestamps need to fit 56 bits.");
+
+        const uint8_t p = (uint8_t)(lzcnt(y) + 1);
+        std::vector<uint64_t> &L = L_[y_up];
+
+        /* drop pairs with rank <= p from the back, they can never be the maximum again */
+        while (!L.empty() && rank(L.back()) <= p)
+        {
+            L.pop_back();
+        }
+        L.push_back(pair(t, p));
+        /* drop pairs that left the maximum window from the front */
+        size_t expired = 0;
+        while (expired < L.size() && !in_window(L[expired], max_window_, t))
+        {
+            expired++;
+        }
+        L.erase(L.begin(), L.begin() + expired);
+    }
+
+    /**
+     * Drop the pairs of all registers that left the maximum window at time now.
+     */
+    void expire(uint64_t now)
+    {
+        for (auto &L : L_)
+        {
+            size_t expired = 0;
+            while (expired < L.size() && !in_window(L[expired], max_window_, now))
+            {
+                expired++;
+            }
+            L.erase(L.begin(), L.begin() + expired);
+        }
+    }
+
+    /**
+     * Raw HLL estimate of the number of distinct hash values with timestamp in (now - window, now].
+     * (window <= max_window)
+     */
+    double estimate(uint64_t window, uint64_t now) const
+    {
+        assert(window <= max_window_ && "Window longer than the maximum window.");
+        const int m = this->m();
+        constexpr int block = 256;
+        uint8_t R[block];
+        /* by FlFuGaMe07: compute Z := ( sum_ 2^(-R[k]) )^-1 */
+        hll_inverse_sum sum;
+        for (int k = 0; k < m; k += block)
+        {
+            const int n = std::min(block, m - k);
+            for (int i = 0; i < n; i++)
+            {
+                R[i] = register_at(k + i, window, now);
+            }
+            sum.add(R, n);
+        }
+        double E = 1./sum.result();
+        /* by FlFuGaMe07: "raw" HLL estimate: E := alpha_m * m^2 * Z */
+        E = alpha(m) * m*m * E;
+        /* note that we're not doing small/large range corrections */
+        return E;
+    }
+
+    /**
+     * Value of register k for the window (now - window, now].
+     */
+    uint8_t register_at(int k, uint64_t window, uint64_t now) const
+    {
+        for (uint64_t e : L_[k])
+        {
+            if (in_window(e, window, now))  return rank(e);
+        }
+        return 0;
+    }
+
+private:
+    int logm_;
+    uint64_t mask_;
+    uint64_t max_window_;
+    std::vector<std::vector<uint64_t>> L_; /* per register: pairs (timestamp << 8 | rank), oldest first */
+
+    static uint64_t pair(uint64_t t, uint8_t p) { return (t << 8) | p; }
+    static uint64_t timestamp(uint64_t e) { return e >> 8; }
+    static uint8_t rank(uint64_t e) { return (uint8_t)(e & 0xff); }
+
+    static bool in_window(uint64_t e, uint64_t window, uint64_t now)
+    {
+        return timestamp(e) + window > now;
+    }
+};
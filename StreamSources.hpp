@@ -0,0 +1,203 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <iterator>
+#include <utility>
+#include <type_traits>
+#include <cstdint>
+#include "clhash/clhash.h"
+
+/*
+ * Pull sources: data streams that are read chunk by chunk instead of being held in memory, for
+ * the *_stream() estimators (hll_stream(), rec_stream(), rec_nohash_stream(), kmv_stream(),
+ * cardinality_stream()). A source has a value_type and a member
+ *
+ *     size_t next(std::vector<value_type> &chunk, size_t max)
+ *
+ * that overwrites chunk[0], ..., chunk[n-1] with the next n <= max elements of the stream (growing
+ * chunk if needed) and returns n, 0 once the stream is exhausted. Chunks are reused across calls,
+ * so an estimator reading a source needs memory for its sketch and one chunk only.
+ */
+
+/**
+ * Source over an iterator range [first, last), e.g. of a container or a lazily generated range.
+ */
+template <typename iterator_type>
+class RangeSource
+{
+public:
+    using value_type = typename std::iterator_traits<iterator_type>::value_type;
+
+    RangeSource(iterator_type first, iterator_type last)
+        : it_(first), last_(last)
+    {}
+
+    size_t next(std::vector<value_type> &chunk, size_t max)
+    {
+        if (chunk.size() < max)  chunk.resize(max);
+        size_t n = 0;
+        for (; n < max && it_ != last_; ++it_, n++)
+        {
+            chunk[n] = *it_;
+        }
+        return n;
+    }
+
+private:
+    iterator_type it_;
+    iterator_type last_;
+};
+
+template <typename iterator_type>
+inline RangeSource<iterator_type> range_source(iterator_type first, iterator_type last)
+{
+    return RangeSource<iterator_type>(first, last);
+}
+
+template <typename range_type>
+inline auto range_source(const range_type &Z)
+{
+    return range_source(std::begin(Z), std::end(Z));
+}
+
+
+/**
+ * Source of the words of a text stream (a file, or e.g. std::cin), split at white space like
+ * read_stream(). The words of a chunk keep their buffers, so reading allocates only for words
+ * longer than any read into the same place before.
+ */
+class WordSource
+{
+public:
+    using value_type = std::string;
+
+    /**
+     * in       input stream, needs to outlive the source
+     */
+    explicit WordSource(std::istream &in)
+        : in_(in)
+    {}
+
+    /**
+     * filepath     path to file
+     */
+    explicit WordSource(const std::string &filepath)
+        : file_(new std::ifstream(filepath, std::ios_base::in)), in_(*file_)
+    {
+        if (!file_->is_open())
+        {
+            std::cerr << "Couldn't open data stream input file!\n";
+            throw;
+        }
+    }
+
+    size_t next(std::vector<std::string> &chunk, size_t max)
+    {
+        if (chunk.size() < max)  chunk.resize(max);
+        size_t n = 0;
+        while (n < max && in_ >> chunk[n])  n++;
+        return n;
+    }
+
+private:
+    std::unique_ptr<std::ifstream> file_;
+    std::istream &in_;
+};
+
+
+/**
+ * Source of the n values generate(), generate(), ... (e.g. draws from a distribution).
+ */
+template <typename generator_type>
+class GeneratorSource
+{
+public:
+    using value_type = std::decay_t<decltype(std::declval<generator_type &>()())>;
+
+    GeneratorSource(generator_type generate, uint64_t n)
+        : generate_(std::move(generate)), remaining_(n)
+    {}
+
+    size_t next(std::vector<value_type> &chunk, size_t max)
+    {
+        if (chunk.size() < max)  chunk.resize(max);
+        size_t n = 0;
+        for (; n < max && remaining_ > 0; n++, remaining_--)
+        {
+            chunk[n] = generate_();
+        }
+        return n;
+    }
+
+private:
+    generator_type generate_;
+    uint64_t remaining_;
+};
+
+template <typename generator_type>
+inline GeneratorSource<generator_type> generator_source(generator_type generate, uint64_t n)
+{
+    return GeneratorSource<generator_type>(std::move(generate), n);
+}
+
+
+/**
+ * Source of the keys of a frequency table (see read_frequencies()) that occur in the stream,
+ * K[i] with C[i] > 0, once each and in table order. K and C need to outlive the source.
+ */
+template <typename z_type>
+class FrequencySource
+{
+public:
+    using value_type = z_type;
+
+    FrequencySource(const std::vector<z_type> &K, const std::vector<uint64_t> &C)
+        : K_(K), C_(C), i_(0)
+    {}
+
+    size_t next(std::vector<z_type> &chunk, size_t max)
+    {
+        if (chunk.size() < max)  chunk.resize(max);
+        size_t n = 0;
+        for (; n < max && i_ < K_.size(); i_++)
+        {
+            if (C_[i_] > 0)  chunk[n++] = K_[i_];
+        }
+        return n;
+    }
+
+private:
+    const std::vector<z_type> &K_;
+    const std::vector<uint64_t> &C_;
+    size_t i_;
+};
+
+
+/**
+ * Hash a source in blocks of 256 elements, calling f(Y, n) with the hash values Y[0], ..., Y[n-1]
+ * of every block, in stream order.
+ *
+ * hash     hash function (instance of clhasher struct)
+ * source   pull source (see above)
+ *
+ * Return value: number of elements read
+ */
+template <typename source_type, typename F>
+inline uint64_t hash_source(clhasher &hash, source_type &source, F f)
+{
+    constexpr size_t block = 256;
+    std::vector<typename source_type::value_type> chunk;
+    uint64_t Y[block];
+    uint64_t N = 0;
+    while (const size_t n = source.next(chunk, block))
+    {
+        hash.hash_many(chunk.data(), n, Y);
+        f((const uint64_t *)Y, n);
+        N += n;
+    }
+    return N;
+}
@@ -0,0 +1,257 @@
+#pragma once
+
+#include "Recordinality.hpp"
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cmath>
+#include <cstdint>
+#include <cassert>
+
+/**
+ * Theta sketch: the distinct hash values y >= t out of a set, for a threshold t. Every hash
+ * value is >= t with probability p = 1 - t/2^64, so (number of values kept) / p estimates the
+ * number of distinct hash values of the set (exactly if t == 0).
+ *
+ * Built from a stream by KMVSketch, and closed under union, intersection and difference
+ * (theta_union(), theta_intersection(), theta_difference()) of sketches built with the same hash
+ * function, each in O(k). This makes shards of a stream sketchable in parallel.
+ *
+ * Memory: at most k-1 hash values + t
+ */
+class ThetaSketch
+{
+public:
+    /**
+     * k        nominal size (the sketch keeps at most k-1 values), k >= 2
+     * t        threshold
+     * values   sorted distinct hash values >= t
+     */
+    ThetaSketch(int k, uint64_t t, std::vector<uint64_t> values)
+        : k_(k), t_(t), values_(std::move(values))
+    {
+        assert(k >= 2 && "Theta sketches need k >= 2.");
+        assert(std::is_sorted(values_.begin(), values_.end()) && (values_.empty() || values_[0] >= t_));
+    }
+
+    int k() const { return k_; }
+    uint64_t threshold() const { return t_; }
+    const std::vector<uint64_t> &values() const { return values_; }
+    bool is_exact() const { return t_ == 0; }
+
+    /**
+     * p = P(y >= t) for a uniformly random hash value y.
+     */
+    double theta() const { return 1.0 - (double)t_ * 0x1p-64; }
+
+    /**
+     * Estimate of the number of distinct hash values of the set.
+     */
+    double estimate() const { return values_.size() / theta(); }
+
+    /**
+     * Bounds of about num_std_dev standard deviations around estimate(): the number of values
+     * kept is Binomial(n, p) for n distinct hash values, so the estimate has standard deviation
+     * sqrt(n(1-p)/p), approximated with the estimate for n. The lower bound is at least the
+     * number of values kept, both bounds equal the estimate if it is exact.
+     *
+     * For a full sketch out of a stream the relative standard error is about 1/sqrt(k-2).
+     */
+    double lower_bound(double num_std_dev = 2) const
+    {
+        return std::max((double)values_.size(), estimate() - num_std_dev * std_dev());
+    }
+    double upper_bound(double num_std_dev = 2) const
+    {
+        return estimate() + num_std_dev * std_dev();
+    }
+
+    /**
+     * Keep only the largest k-1 values, raising the threshold past the k-th largest.
+     */
+    void trim()
+    {
+        if ((int)values_.size() < k_)  return;
+        const size_t drop = values_.size() - (k_ - 1);
+        t_ = values_[drop - 1] + 1;
+        values_.erase(values_.begin(), values_.begin() + drop);
+    }
+
+private:
+    int k_;
+    uint64_t t_;
+    std::vector<uint64_t> values_;
+
+    double std_dev() const
+    {
+        const double p = theta();
+        return std::sqrt(estimate() * (1 - p) / p);
+    }
+
+    /* values of A at or above threshold t */
+    static std::vector<uint64_t>::const_iterator from(const ThetaSketch &A, uint64_t t)
+    {
+        return std::lower_bound(A.values_.begin(), A.values_.end(), t);
+    }
+
+    friend ThetaSketch theta_union(const ThetaSketch &A, const ThetaSketch &B);
+    friend ThetaSketch theta_intersection(const ThetaSketch &A, const ThetaSketch &B);
+    friend ThetaSketch theta_difference(const ThetaSketch &A, const ThetaSketch &B);
+};
+
+
+/**
+ * Sketch of the union of the sets of A and B, keeping at most min(k_A, k_B) - 1 values.
+ */
+inline ThetaSketch theta_union(const ThetaSketch &A, const ThetaSketch &B)
+{
+    const uint64_t t = std::max(A.t_, B.t_);
+    std::vector<uint64_t> values;
+    values.reserve(A.values_.size() + B.values_.size());
+    std::set_union(ThetaSketch::from(A, t), A.values_.end(), ThetaSketch::from(B, t), B.values_.end(),
+                   std::back_inserter(values));
+    ThetaSketch U(std::min(A.k_, B.k_), t, std::move(values));
+    U.trim();
+    return U;
+}
+
+/**
+ * Sketch of the intersection of the sets of A and B.
+ */
+inline ThetaSketch theta_intersection(const ThetaSketch &A, const ThetaSketch &B)
+{
+    const uint64_t t = std::max(A.t_, B.t_);
+    std::vector<uint64_t> values;
+    std::set_intersection(ThetaSketch::from(A, t), A.values_.end(), ThetaSketch::from(B, t), B.values_.end(),
+                          std::back_inserter(values));
+    return ThetaSketch(std::min(A.k_, B.k_), t, std::move(values));
+}
+
+/**
+ * Sketch of the set of A minus the set of B.
+ */
+inline ThetaSketch theta_difference(const ThetaSketch &A, const ThetaSketch &B)
+{
+    const uint64_t t = std::max(A.t_, B.t_);
+    std::vector<uint64_t> values;
+    std::set_difference(ThetaSketch::from(A, t), A.values_.end(), ThetaSketch::from(B, t), B.values_.end(),
+                        std::back_inserter(values));
+    return ThetaSketch(std::min(A.k_, B.k_), t, std::move(values));
+}
+
+
+/**
+ * k minimum values sketch (in the mirrored form: the k largest hash values) on a stream. The
+ * top-k set is maintained by RecordinalitySketch, so ingestion costs the same as rec(); the
+ * k-th largest value becomes the threshold of the ThetaSketch, the other k-1 its values.
+ *
+ * Memory: k hash values (see RecordinalitySketch)
+ */
+class KMVSketch
+{
+public:
+    /**
+     * k        k, >= 2
+     */
+    explicit KMVSketch(int k)
+        : top_(k)
+    {
+        assert(k >= 2 && "KMV needs k >= 2.");
+    }
+
+    int k() const { return top_.k(); }
+
+    /**
+     * Add hash value y.
+     */
+    void add(uint64_t y) { top_.add(y); }
+
+    /**
+     * Add n hash values Y[0], ..., Y[n-1].
+     */
+    void add_batch(const uint64_t *Y, size_t n) { top_.add_batch(Y, n); }
+
+    /**
+     * Merge other into this sketch (both need to share the hash function), giving the sketch
+     * of the concatenated streams.
+     */
+    void merge(const KMVSketch &other)
+    {
+        const std::vector<uint64_t> &V = other.top_.values();
+        top_.add_batch(V.data(), V.size());
+    }
+
+    /**
+     * Theta sketch of the distinct hash values added so far.
+     */
+    ThetaSketch theta() const
+    {
+        std::vector<uint64_t> values(top_.values());
+        std::sort(values.begin(), values.end());
+        ThetaSketch S(k(), 0, std::move(values));
+        S.trim();
+        return S;
+    }
+
+    /**
+     * Estimate of the number of distinct hash values added so far: exact for fewer than k,
+     * else (k-1) / P(y > k-th largest value).
+     */
+    double estimate() const { return theta().estimate(); }
+
+private:
+    RecordinalitySketch top_;
+};
+
+
+/**
+ * KMV (theta sketch) cardinality estimation through the k largest hash values.
+ *
+ * hash     hash function (instance of clhasher struct)
+ * Z        data stream / multiset
+ * k        k, >= 2
+ *
+ * Memory: k hash values
+ */
+template <typename z_type>
+inline ThetaSketch kmv(clhasher &hash, const std::vector<z_type> &Z, int k)
+{
+    KMVSketch sketch(k);
+    /* hash blocks of the stream and feed them to the batched ingest */
+    constexpr int block = 256;
+    uint64_t Y[block];
+    for (int j = 0; j < (int)Z.size(); j += block)
+    {
+        const int n = std::min(block, (int)Z.size() - j);
+        hash.hash_many(Z.data() + j, n, Y);
+        sketch.add_batch(Y, n);
+    }
+    return sketch.theta();
+}
+
+
+/**
+ * KMV (theta sketch) cardinality estimation on precomputed hash values Y[0], ..., Y[n-1]
+ * (see hash_stream()).
+ */
+inline ThetaSketch kmv_hashed(const uint64_t *Y, size_t n, int k)
+{
+    KMVSketch sketch(k);
+    sketch.add_batch(Y, n);
+    return sketch.theta();
+}
+
+
+/**
+ * KMV (theta sketch) cardinality estimation on a pull source (see StreamSources.hpp), read once,
+ * chunk by chunk.
+ *
+ * Memory: k hash values + one chunk, independent of the stream length
+ */
+template <typename source_type>
+inline ThetaSketch kmv_stream(clhasher &hash, source_type &source, int k)
+{
+    KMVSketch sketch(k);
+    hash_source(hash, source, [&](const uint64_t *Y, size_t n) { sketch.add_batch(Y, n); });
+    return sketch.theta();
+}
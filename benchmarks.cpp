@@ -0,0 +1,829 @@
+#include "HyperLogLog.hpp"
+#include "HyperLogLogPacked.hpp"
+#include "HyperLogLogSparse.hpp"
+#include "ConcurrentHyperLogLog.hpp"
+#include "SlidingHyperLogLog.hpp"
+#include "Recordinality.hpp"
+#include "ThetaSketch.hpp"
+#include "PerfectCounting.hpp"
+#include "ExternalCounting.hpp"
+#include "StreamSources.hpp"
+#include "EncodedStream.hpp"
+#include "SketchStore.hpp"
+#include "datastreams.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <unordered_set>
+
+std::mt19937_64 bench_rng(*(int*)"bnch");
+
+/**
+ * Run f() repeatedly for at least min_seconds and return the average time per run in seconds.
+ */
+template <typename F>
+double time_per_run(F f, double min_seconds = 0.2)
+{
+    using clock = std::chrono::steady_clock;
+    int runs = 0;
+    const auto start = clock::now();
+    double elapsed = 0.0;
+    do
+    {
+        f();
+        runs++;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < min_seconds);
+    return elapsed / runs;
+}
+
+/* keep the optimizer from dropping benchmarked results */
+volatile double bench_sink;
+
+
+/**
+ * HLL register update and harmonic sum: one hash at a time (as in the original hll() loop)
+ * vs. the batched kernels (checked to give the same registers resp. sum), for the values log(m)
+ * of synthetic_experimets().
+ */
+void hll_kernel_benchmark()
+{
+    std::vector<int> logm({4,5,6,7,8,9,10,12,16});
+    constexpr int num_hashes = 1 << 22;
+
+    std::vector<uint64_t> Y(num_hashes);
+    for (auto &y : Y)  y = bench_rng();
+
+    std::cout << "HLL register update (ns/hash) and harmonic sum (ns/register)" << std::endl;
+    std::cout << std::setw(8) << "m" << std::setw(12) << "upd loop" << std::setw(12) << "upd scalar"
+              << std::setw(12) << "upd batch" << std::setw(12) << "sum loop" << std::setw(12) << "sum batch" << std::endl;
+    for (int i = 0; i < (int)logm.size(); i++)
+    {
+        const int m = uiexp2(logm[i]);
+        const uint64_t mask = m - 1;
+        std::vector<uint8_t> R(m), R_scalar(m), R_batch(m);
+
+        /* original loop: mask, lzcnt, compare, store for one hash at a time */
+        const double t_loop = time_per_run([&]() {
+            for (int j = 0; j < num_hashes; j++)
+            {
+                const uint64_t y = Y[j];
+                const uint64_t y_up = (y & mask);
+                if ((y & ~mask) == 0) {std::cerr<<"HLL FAILURE: Not enough bits in hash!\n"; throw;}
+                const uint64_t p = lzcnt(y) + 1;
+                if (p > R[y_up])  R[y_up] = (uint8_t)p;
+            }
+        });
+        const double t_scalar = time_per_run([&]() { hll_update_scalar(R_scalar.data(), mask, Y.data(), num_hashes); });
+        const double t_batch = time_per_run([&]() { hll_update(R_batch.data(), mask, Y.data(), num_hashes); });
+        if (R_scalar != R || R_batch != R)
+        {
+            std::cerr << "HLL register update kernels differ from the loop!\n";
+            throw;
+        }
+
+        /* original estimator loop: shift and division for every register */
+        double E_loop = 0.0, E_batch = 0.0;
+        const double t_sum_loop = time_per_run([&]() {
+            double E = 0.0;
+            for (int k = 0; k < m; k++)
+            {
+                E += 1./uiexp2<uint64_t>(R[k]);
+            }
+            E_loop = E;
+            bench_sink = E;
+        }, 0.05);
+        const double t_sum_batch = time_per_run([&]() {
+            hll_inverse_sum sum;
+            sum.add(R.data(), m);
+            E_batch = sum.result();
+            bench_sink = E_batch;
+        }, 0.05);
+        /* same terms summed in another order: equal up to rounding, and exactly the scalar kernel's */
+        hll_inverse_sum sum_scalar;
+        sum_scalar.add_scalar(R.data(), m);
+        if (sum_scalar.result() != E_batch || std::abs(E_batch - E_loop) > 1e-12 * E_loop)
+        {
+            std::cerr << "HLL harmonic sum kernels differ from the loop!\n";
+            throw;
+        }
+
+        std::cout << std::fixed << std::setprecision(3) << std::setw(8) << m
+                  << std::setw(12) << t_loop / num_hashes * 1e9
+                  << std::setw(12) << t_scalar / num_hashes * 1e9
+                  << std::setw(12) << t_batch / num_hashes * 1e9
+                  << std::setw(12) << t_sum_loop / m * 1e9
+                  << std::setw(12) << t_sum_batch / m * 1e9 << std::endl;
+    }
+}
+
+
+/**
+ * Memory and update/merge/estimate throughput of one HLL register layout.
+ */
+template <typename sketch_type>
+void hll_layout_benchmark_row(const char *name, int logm, const std::vector<uint64_t> &Y)
+{
+    sketch_type a(logm), b(logm);
+    const double t_add = time_per_run([&]() { a.add_batch(Y.data(), Y.size()); });
+    b.add_batch(Y.data(), Y.size() / 2);
+    const double t_merge = time_per_run([&]() { sketch_type c(a); c.merge(b); bench_sink = c.m(); }, 0.05);
+    const double t_est = time_per_run([&]() { bench_sink = a.estimate(); }, 0.05);
+
+    std::cout << std::fixed << std::setprecision(3) << std::setw(10) << name
+              << std::setw(12) << a.memory()
+              << std::setw(12) << t_add / Y.size() * 1e9
+              << std::setw(12) << t_merge / a.m() * 1e9
+              << std::setw(12) << t_est / a.m() * 1e9
+              << std::setw(16) << std::setprecision(1) << a.estimate() << std::endl;
+}
+
+/**
+ * HLL register layouts: 8 bit bytes vs. packed 6, 5 and 4 bit registers.
+ */
+void hll_layout_benchmark()
+{
+    constexpr int logm = 14;
+    std::vector<uint64_t> Y(1 << 22);
+    for (auto &y : Y)  y = bench_rng();
+
+    std::cout << "HLL register layouts, m = " << uiexp2(logm) << ", " << Y.size() << " hashes" << std::endl;
+    std::cout << std::setw(10) << "layout" << std::setw(12) << "bytes" << std::setw(12) << "ns/add"
+              << std::setw(12) << "ns/reg mrg" << std::setw(12) << "ns/reg est" << std::setw(16) << "estimate" << std::endl;
+    hll_layout_benchmark_row<HyperLogLogSketch>("8 bit", logm, Y);
+    hll_layout_benchmark_row<HyperLogLogSketch6>("6 bit", logm, Y);
+    hll_layout_benchmark_row<HyperLogLogSketch5>("5 bit", logm, Y);
+    hll_layout_benchmark_row<HyperLogLogSketch4>("4 bit", logm, Y);
+}
+
+
+/**
+ * Sparse vs. dense HLL with m = 2^16 on the low-cardinality real datasets.
+ */
+void hll_sparse_benchmark()
+{
+    constexpr int logm = 16;
+    const char *datasets[] = {"midsummer-nights-dream", "mare-balena", "valley-fear"};
+    clhasher h(bench_rng(), bench_rng());
+
+    std::cout << "Sparse vs. dense HLL, m = " << uiexp2(logm) << std::endl;
+    std::cout << std::setw(24) << "dataset" << std::setw(10) << "sparse" << std::setw(12) << "bytes"
+              << std::setw(12) << "bytes dns" << std::setw(12) << "us/est" << std::setw(12) << "us/est fl" << std::setw(12) << "us/est dns" << std::endl;
+    for (const char *dataset : datasets)
+    {
+        std::vector<std::string> Z;
+        read_stream(Z, std::string("../datasets/") + dataset + ".txt");
+        std::vector<uint64_t> Y(Z.size());
+        for (size_t j = 0; j < Z.size(); j++)  Y[j] = h(Z[j]);
+
+        SparseHyperLogLogSketch sparse(logm);
+        HyperLogLogSketch dense(logm);
+        sparse.add_batch(Y.data(), Y.size());
+        dense.add_batch(Y.data(), Y.size());
+        const double t_sparse = time_per_run([&]() { bench_sink = sparse.estimate(); }, 0.05);
+        sparse.flush();
+        const double t_flushed = time_per_run([&]() { bench_sink = sparse.estimate(); }, 0.05);
+        const double t_dense = time_per_run([&]() { bench_sink = dense.estimate(); }, 0.05);
+
+        std::cout << std::fixed << std::setprecision(1) << std::setw(24) << dataset
+                  << std::setw(10) << sparse.is_sparse()
+                  << std::setw(12) << sparse.memory()
+                  << std::setw(12) << dense.memory()
+                  << std::setw(12) << t_sparse * 1e6
+                  << std::setw(12) << t_flushed * 1e6
+                  << std::setw(12) << t_dense * 1e6 << std::endl;
+    }
+}
+
+
+/**
+ * Concurrent HLL: throughput of 1 to N threads adding to one shared sketch, with a reader
+ * estimating concurrently.
+ */
+void hll_concurrent_benchmark()
+{
+    constexpr int logm = 12;
+    const int max_threads = std::max(4u, std::thread::hardware_concurrency());
+    std::vector<uint64_t> Y(1 << 24);
+    for (auto &y : Y)  y = bench_rng();
+
+    HyperLogLogSketch reference(logm);
+    reference.add_batch(Y.data(), Y.size());
+
+    std::cout << "Concurrent HLL, m = " << uiexp2(logm) << ", " << Y.size() << " hashes ("
+              << std::thread::hardware_concurrency() << " hardware threads)" << std::endl;
+    std::cout << std::setw(8) << "threads" << std::setw(12) << "Mhash/s" << std::setw(12) << "speedup"
+              << std::setw(10) << "exact" << std::endl;
+    double t_single = 0.0;
+    for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+    {
+        ConcurrentHyperLogLogSketch sketch(logm);
+        const double t = time_per_run([&]() {
+            std::vector<std::thread> threads;
+            std::atomic<bool> done(false);
+            std::thread reader([&]() { while (!done)  bench_sink = sketch.estimate(); });
+            const size_t slice = Y.size() / num_threads;
+            for (int i = 0; i < num_threads; i++)
+            {
+                const size_t begin = i*slice, end = (i == num_threads - 1) ? Y.size() : begin + slice;
+                threads.emplace_back([&, begin, end]() { sketch.add_batch(Y.data() + begin, end - begin); });
+            }
+            for (auto &thread : threads)  thread.join();
+            done = true;
+            reader.join();
+        });
+        if (num_threads == 1)  t_single = t;
+
+        std::cout << std::fixed << std::setprecision(2) << std::setw(8) << num_threads
+                  << std::setw(12) << Y.size() / t * 1e-6
+                  << std::setw(12) << t_single / t
+                  << std::setw(10) << (sketch.estimate() == reference.estimate()) << std::endl;
+    }
+}
+
+
+/**
+ * Sliding window HLL over a stream with timestamp = position: memory per register vs. the
+ * plain sketch, and the estimate for several windows vs. a plain sketch of just that window.
+ */
+void hll_sliding_benchmark()
+{
+    constexpr int logm = 12;
+    constexpr uint64_t max_window = 1 << 20;
+    std::vector<uint64_t> Y(1 << 22);
+    for (auto &y : Y)  y = bench_rng();
+
+    SlidingHyperLogLogSketch sliding(logm, max_window);
+    const double t_add = time_per_run([&]() {
+        SlidingHyperLogLogSketch S(logm, max_window);
+        for (size_t t = 0; t < Y.size(); t++)  S.add(Y[t], t);
+        bench_sink = S.num_pairs();
+    });
+    for (size_t t = 0; t < Y.size(); t++)  sliding.add(Y[t], t);
+    sliding.expire(Y.size() - 1);
+    const HyperLogLogSketch plain(logm);
+
+    std::cout << "Sliding window HLL, m = " << uiexp2(logm) << ", max window " << max_window << ", "
+              << Y.size() << " hashes, " << std::setprecision(1) << std::fixed << Y.size() / t_add * 1e-6 << " Mhash/s" << std::endl;
+    std::cout << "pairs/register " << std::setprecision(2) << (double)sliding.num_pairs() / sliding.m()
+              << ", bytes/register " << (double)sliding.memory() / sliding.m()
+              << " (plain: " << (double)plain.memory() / plain.m() << ")" << std::endl;
+    std::cout << std::setw(10) << "window" << std::setw(14) << "sliding" << std::setw(14) << "plain"
+              << std::setw(12) << "us/est" << std::endl;
+    const uint64_t now = Y.size() - 1;
+    for (uint64_t window = max_window >> 8; window <= max_window; window <<= 2)
+    {
+        HyperLogLogSketch window_sketch(logm);
+        window_sketch.add_batch(Y.data() + (now + 1 - window), window);
+        const double t_est = time_per_run([&]() { bench_sink = sliding.estimate(window, now); }, 0.05);
+        std::cout << std::setw(10) << window
+                  << std::setw(14) << std::setprecision(1) << sliding.estimate(window, now)
+                  << std::setw(14) << window_sketch.estimate()
+                  << std::setw(12) << t_est * 1e6 << std::endl;
+    }
+}
+
+
+/**
+ * Recordinality set scans over S with k elements: membership of a value not in S (full scan)
+ * and the second minimum, scalar vs. vectorized kernels (checked to agree), for the values k of
+ * synthetic_experimets(). Then rec_nohash() on a stream of 64 bit values, which scans S with
+ * the kernels, next to the sorted array of rec_nohash_stream() (checked to give the same estimate).
+ */
+void rec_kernel_benchmark()
+{
+    std::vector<int> k({4,8,16,32,64,128,256,512,1024});
+    constexpr int num_scans = 1 << 12;
+    constexpr int stream_length = 1 << 16;
+
+    /* 2^14 distinct values, each repeated about 4 times */
+    std::vector<uint64_t> pool(1 << 14), Z(stream_length);
+    for (auto &z : pool)  z = bench_rng();
+    for (auto &z : Z)  z = pool[bench_rng() % pool.size()];
+
+    std::cout << "Recordinality set scans (ns/scan), rec_nohash() on " << stream_length << " 64 bit values (ns/element)" << std::endl;
+    std::cout << std::setw(8) << "k" << std::setw(14) << "find scalar" << std::setw(12) << "find vec"
+              << std::setw(14) << "min2 scalar" << std::setw(12) << "min2 vec"
+              << std::setw(12) << "nohash" << std::setw(12) << "sorted" << std::endl;
+    for (int i = 0; i < (int)k.size(); i++)
+    {
+        std::vector<uint64_t> S(k[i]), Y(num_scans);
+        for (auto &s : S)  s = bench_rng();
+        for (auto &y : Y)  y = bench_rng();
+        Y[0] = S[k[i] - 1]; /* one hit, in the tail */
+        const uint64_t minS = *std::min_element(S.begin(), S.end());
+
+        int found_scalar = 0, found = 0;
+        uint64_t min2_scalar = 0, min2 = 0;
+        const double t_find_scalar = time_per_run([&]() {
+            found_scalar = 0;
+            for (uint64_t y : Y)  found_scalar += rec_find_scalar(S.data(), k[i], y);
+            bench_sink = found_scalar;
+        }, 0.05);
+        const double t_find = time_per_run([&]() {
+            found = 0;
+            for (uint64_t y : Y)  found += rec_find(S.data(), k[i], y);
+            bench_sink = found;
+        }, 0.05);
+        const double t_min2_scalar = time_per_run([&]() {
+            min2_scalar = 0;
+            uint64_t min;
+            for (uint64_t y : Y)  min2_scalar += rec_min2_scalar(S.data(), k[i], minS ^ (y & 1), min) + min;
+            bench_sink = min2_scalar;
+        }, 0.05);
+        const double t_min2 = time_per_run([&]() {
+            min2 = 0;
+            uint64_t min;
+            for (uint64_t y : Y)  min2 += rec_min2(S.data(), k[i], minS ^ (y & 1), min) + min;
+            bench_sink = min2;
+        }, 0.05);
+        if (found != found_scalar || min2 != min2_scalar)
+        {
+            std::cerr << "Vectorized Recordinality scans differ from scalar ones!\n";
+            throw;
+        }
+
+        double E_nohash = 0, E_sorted = 0;
+        const double t_nohash = time_per_run([&]() { E_nohash = rec_nohash(Z, k[i]); bench_sink = E_nohash; }, 0.05);
+        const double t_sorted = time_per_run([&]() {
+            auto source = range_source(Z);
+            E_sorted = rec_nohash_stream(source, k[i]);
+            bench_sink = E_sorted;
+        }, 0.05);
+        if (E_nohash != E_sorted)
+        {
+            std::cerr << "rec_nohash() differs from rec_nohash_stream()!\n";
+            throw;
+        }
+
+        std::cout << std::fixed << std::setprecision(1) << std::setw(8) << k[i]
+                  << std::setw(14) << t_find_scalar / num_scans * 1e9
+                  << std::setw(12) << t_find / num_scans * 1e9
+                  << std::setw(14) << t_min2_scalar / num_scans * 1e9
+                  << std::setw(12) << t_min2 / num_scans * 1e9
+                  << std::setw(12) << t_nohash / stream_length * 1e9
+                  << std::setw(12) << t_sorted / stream_length * 1e9 << std::endl;
+    }
+}
+
+
+/**
+ * Recordinality ingestion (ns/element) on a stream of 64 bit keys: hashing alone, the k-record
+ * test one value at a time, and rec() with the batched threshold pre-filter (hashing included).
+ */
+void rec_ingest_benchmark()
+{
+    std::vector<int> k({16,64,256,1024});
+    constexpr int num_keys = 1 << 22;
+    clhasher h(bench_rng(), bench_rng());
+
+    std::vector<uint64_t> Z(num_keys), Y(num_keys);
+    for (auto &z : Z)  z = bench_rng();
+    const double t_hash = time_per_run([&]() {
+        for (int j = 0; j < num_keys; j++)  Y[j] = h(Z[j]);
+    });
+
+    std::cout << "Recordinality ingestion (ns/element), hashing alone " << std::setprecision(2) << t_hash / num_keys * 1e9 << std::endl;
+    std::cout << std::setw(8) << "k" << std::setw(12) << "add loop" << std::setw(12) << "add batch"
+              << std::setw(12) << "rec()" << std::endl;
+    for (int i = 0; i < (int)k.size(); i++)
+    {
+        const double t_loop = time_per_run([&]() {
+            RecordinalitySketch sketch(k[i]);
+            for (int j = 0; j < num_keys; j++)  sketch.add(Y[j]);
+            bench_sink = sketch.estimate();
+        });
+        const double t_batch = time_per_run([&]() {
+            RecordinalitySketch sketch(k[i]);
+            sketch.add_batch(Y.data(), num_keys);
+            bench_sink = sketch.estimate();
+        });
+        const double t_rec = time_per_run([&]() { bench_sink = rec(h, Z, k[i]); });
+
+        std::cout << std::fixed << std::setprecision(2) << std::setw(8) << k[i]
+                  << std::setw(12) << t_loop / num_keys * 1e9
+                  << std::setw(12) << t_batch / num_keys * 1e9
+                  << std::setw(12) << t_rec / num_keys * 1e9 << std::endl;
+    }
+}
+
+
+/**
+ * Theta sketches on two overlapping shards of n distinct keys, A = keys[0, 3n/4) and B = keys[n/4, n):
+ * union, intersection and difference estimates against the exact counts (mean relative error
+ * and how often the count lies within lower_bound() and upper_bound(), over hash functions),
+ * and ingestion (kmv() next to rec()) and merge throughput.
+ */
+void theta_benchmark()
+{
+    std::vector<int> k({64,256,1024});
+    constexpr int n = 1 << 18;
+    constexpr int trials = 64;
+    /* random keys: the extreme hash values of consecutive integers under clhash are not uniform enough */
+    std::vector<uint64_t> keys(n);
+    for (auto &z : keys)  z = bench_rng();
+    const std::vector<uint64_t> A(keys.begin(), keys.begin() + 3*n/4), B(keys.begin() + n/4, keys.end());
+    const double exact[3] = {(double)n, (double)n/2, (double)n/4};
+
+    std::cout << "Theta sketches, shards of " << A.size() << " keys overlapping in " << n/2
+              << ", mean relative error / coverage of [lower_bound, upper_bound] over " << trials << " hash functions" << std::endl;
+    std::cout << std::setw(8) << "k" << std::setw(18) << "union" << std::setw(18) << "intersection"
+              << std::setw(18) << "difference" << std::setw(12) << "kmv()" << std::setw(12) << "rec()"
+              << std::setw(12) << "merge" << std::setw(12) << "union" << std::endl;
+    for (int i = 0; i < (int)k.size(); i++)
+    {
+        double err[3] = {0, 0, 0};
+        int covered[3] = {0, 0, 0};
+        for (int t = 0; t < trials; t++)
+        {
+            clhasher h(bench_rng(), bench_rng());
+            const ThetaSketch SA = kmv(h, A, k[i]);
+            const ThetaSketch SB = kmv(h, B, k[i]);
+            const ThetaSketch S[3] = {theta_union(SA, SB), theta_intersection(SA, SB), theta_difference(SA, SB)};
+            for (int op = 0; op < 3; op++)
+            {
+                err[op] += std::abs(S[op].estimate() / exact[op] - 1.0);
+                covered[op] += S[op].lower_bound() <= exact[op] && exact[op] <= S[op].upper_bound();
+            }
+        }
+
+        clhasher h(bench_rng(), bench_rng());
+        const double t_kmv = time_per_run([&]() { bench_sink = kmv(h, A, k[i]).estimate(); });
+        const double t_rec = time_per_run([&]() { bench_sink = rec(h, A, k[i]); });
+        KMVSketch KA(k[i]), KB(k[i]);
+        for (uint64_t a : A)  KA.add(h(a));
+        for (uint64_t b : B)  KB.add(h(b));
+        const double t_merge = time_per_run([&]() { KMVSketch M(KA); M.merge(KB); bench_sink = M.estimate(); });
+        const ThetaSketch SA = KA.theta(), SB = KB.theta();
+        const double t_union = time_per_run([&]() { bench_sink = theta_union(SA, SB).estimate(); });
+
+        std::cout << std::fixed << std::setw(8) << k[i];
+        for (int op = 0; op < 3; op++)
+        {
+            std::cout << std::setprecision(4) << std::setw(10) << err[op] / trials
+                      << std::setprecision(2) << std::setw(8) << (double)covered[op] / trials;
+        }
+        std::cout << std::setprecision(2) << std::setw(9) << t_kmv / A.size() * 1e9 << " ns"
+                  << std::setw(9) << t_rec / A.size() * 1e9 << " ns"
+                  << std::setw(9) << t_merge * 1e6 << " us" << std::setw(9) << t_union * 1e6 << " us" << std::endl;
+    }
+}
+
+
+/**
+ * Exact count of the distinct elements of Z as cardinality() did before the flat set: inserting
+ * every element into a std::unordered_set.
+ */
+template <typename z_type>
+uint64_t cardinality_unordered_set(const std::vector<z_type> &Z)
+{
+    std::unordered_set<z_type> Zprime;
+    for (const z_type &z : Z)  Zprime.insert(z);
+    return Zprime.size();
+}
+
+/**
+ * Exact cardinality of the 2^24 element synthetic stream of synthetic_experimets() and of the
+ * words of war-peace: std::unordered_set vs. the flat set (checked to agree), then the radix
+ * partitioned count with 1 to N threads.
+ */
+void cardinality_benchmark()
+{
+    std::vector<int> Z;
+    generate_zipfian(Z, 1 << 24, 1 << 24, 0.0);
+    std::vector<std::string> W;
+    read_stream(W, "../datasets/war-peace.txt");
+    const int max_threads = std::max(4u, std::thread::hardware_concurrency());
+
+    std::cout << "Exact cardinality (ms), unordered set vs. flat set" << std::endl;
+    auto row = [&](const char *name, const auto &Z) {
+        uint64_t count_set = 0, count_flat = 0;
+        const double t_set = time_per_run([&]() { count_set = cardinality_unordered_set(Z); bench_sink = count_set; }, 0.0);
+        const double t_flat = time_per_run([&]() { count_flat = cardinality(Z); bench_sink = count_flat; }, 0.0);
+        if (count_set != count_flat)
+        {
+            std::cerr << "Flat set cardinality differs from the unordered set!\n";
+            throw;
+        }
+        std::cout << std::fixed << std::setprecision(1) << std::setw(10) << name << " (" << Z.size() << " elements, "
+                  << count_flat << " distinct)" << std::setw(10) << t_set * 1e3 << std::setw(10) << t_flat * 1e3 << std::endl;
+    };
+    row("synthetic", Z);
+    row("war-peace", W);
+
+    std::cout << "Exact cardinality of the synthetic stream, radix partitioned (" << std::thread::hardware_concurrency()
+              << " hardware threads)" << std::endl;
+    std::cout << std::setw(8) << "threads" << std::setw(12) << "ms" << std::setw(12) << "speedup" << std::endl;
+    double t_single = 0.0;
+    for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+    {
+        const double t = time_per_run([&]() { bench_sink = cardinality(Z, num_threads); }, 0.0);
+        if (num_threads == 1)  t_single = t;
+        std::cout << std::fixed << std::setprecision(2) << std::setw(8) << num_threads
+                  << std::setw(12) << t * 1e3
+                  << std::setw(12) << t_single / t << std::endl;
+    }
+}
+
+
+/**
+ * External memory exact cardinality of war-peace for several memory budgets: runs written,
+ * I/O volume and time per phase.
+ */
+void cardinality_external_benchmark()
+{
+    const std::string path = "../datasets/war-peace.txt";
+    std::cout << "External cardinality, " << path << std::endl;
+    std::cout << std::setw(10) << "budget" << std::setw(10) << "count" << std::setw(8) << "runs"
+              << std::setw(12) << "MB written" << std::setw(12) << "MB reread" << std::setw(12) << "max keys"
+              << std::setw(12) << "ms part" << std::setw(12) << "ms count" << std::endl;
+    for (size_t budget : {size_t(1) << 30, size_t(1) << 22, size_t(1) << 20, size_t(1) << 16})
+    {
+        external_count_stats stats;
+        const uint64_t count = cardinality_external(path, budget, std::filesystem::temp_directory_path().string(), &stats);
+        std::cout << std::fixed << std::setprecision(2) << std::setw(10) << budget
+                  << std::setw(10) << count
+                  << std::setw(8) << stats.num_runs
+                  << std::setw(12) << stats.bytes_written * 1e-6
+                  << std::setw(12) << stats.bytes_reread * 1e-6
+                  << std::setw(12) << stats.max_partition_keys
+                  << std::setw(12) << stats.seconds_partition * 1e3
+                  << std::setw(12) << stats.seconds_count * 1e3 << std::endl;
+    }
+}
+
+
+/**
+ * Estimators on war-peace: read into memory first (read_stream(), then the estimator) vs. read
+ * from the file chunk by chunk through a WordSource.
+ */
+void stream_benchmark()
+{
+    const std::string path = "../datasets/war-peace.txt";
+    clhasher hash(bench_rng(), bench_rng());
+    std::cout << "Streaming estimators, " << path << std::endl;
+    std::cout << std::setw(16) << "estimator" << std::setw(12) << "ms memory" << std::setw(12) << "ms stream" << std::endl;
+    auto row = [&](const char *name, auto in_memory, auto streamed) {
+        const double t_memory = time_per_run([&]() {
+            std::vector<std::string> Z;
+            read_stream(Z, path);
+            bench_sink = in_memory(Z);
+        });
+        const double t_stream = time_per_run([&]() {
+            WordSource source(path);
+            bench_sink = streamed(source);
+        });
+        std::cout << std::fixed << std::setprecision(2) << std::setw(16) << name
+                  << std::setw(12) << t_memory * 1e3
+                  << std::setw(12) << t_stream * 1e3 << std::endl;
+    };
+    row("hll logm=10", [&](const auto &Z) { return hll(hash, Z, 10); },
+                       [&](auto &source) { return hll_stream(hash, source, 10); });
+    row("rec k=256", [&](const auto &Z) { return rec(hash, Z, 256); },
+                     [&](auto &source) { return rec_stream(hash, source, 256); });
+    row("rec_nohash k=256", [&](const auto &Z) { return rec_nohash(Z, 256); },
+                            [&](auto &source) { return rec_nohash_stream(source, 256); });
+    row("cardinality", [&](const auto &Z) { return (double)cardinality(Z); },
+                       [&](auto &source) { return (double)cardinality_stream(source); });
+}
+
+
+/**
+ * Zipfian stream of 2^24 elements over a universe of 2^24: a std::discrete_distribution over the
+ * weights (the former generate_zipfian()) vs. rejection-inversion, with 1 to N threads.
+ */
+void zipfian_benchmark()
+{
+    constexpr int N = 1 << 24;
+    const int max_threads = std::max(4u, std::thread::hardware_concurrency());
+    std::vector<int> Z(N);
+    std::cout << "Zipfian generation, " << N << " elements" << std::endl;
+    std::cout << std::setw(8) << "alpha" << std::setw(16) << "ms discrete";
+    for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+        std::cout << std::setw(12) << ("ms " + std::to_string(num_threads) + "t");
+    std::cout << std::endl;
+    for (double alpha : {0.0, 1.0, 1.5})
+    {
+        const double t_discrete = time_per_run([&]() {
+            std::vector<double> weights(N);
+            for (int i = 0; i < N; i++)  weights[i] = std::pow((double)(i + 1), -alpha);
+            std::discrete_distribution<int> d(weights.begin(), weights.end());
+            for (int j = 0; j < N; j++)  Z[j] = d(bench_rng);
+            bench_sink = Z[N - 1];
+        }, 0.0);
+        std::cout << std::fixed << std::setprecision(2) << std::setw(8) << alpha << std::setw(16) << t_discrete * 1e3;
+        for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+        {
+            const ZipfianStream stream(N, N, alpha, bench_rng());
+            const double t = time_per_run([&]() { stream.generate(Z, num_threads); bench_sink = Z[N - 1]; }, 0.0);
+            std::cout << std::setw(12) << t * 1e3;
+        }
+        std::cout << std::endl;
+    }
+}
+
+
+/**
+ * Estimators on war-peace from the token stream (.txt) vs. the frequency table (.dat), loading
+ * included. Checked first: the exact count and the HLL estimates agree on both (with the byte
+ * order mark removed from the first word and the table's keys, see read_frequencies()).
+ */
+void frequency_benchmark()
+{
+    const std::string path = "../datasets/war-peace";
+    clhasher hash(bench_rng(), bench_rng());
+    {
+        std::vector<std::string> Z, K;
+        std::vector<uint64_t> C;
+        read_stream(Z, path + ".txt");
+        read_frequencies(K, C, path + ".dat");
+        auto strip_bom = [](std::string &z) { if (z.compare(0, 3, "\xEF\xBB\xBF") == 0)  z.erase(0, 3); };
+        if (!Z.empty())  strip_bom(Z[0]);
+        for (std::string &key : K)  strip_bom(key);
+        const std::vector<int> logm({4,8,10,12});
+        if (cardinality(Z) != cardinality_weighted(K, C) || hll(hash, Z, logm) != hll_weighted(hash, K, C, logm))
+        {
+            std::cerr << "Estimators on the frequency table differ from those on the token stream!\n";
+            throw;
+        }
+    }
+    std::cout << "Weighted estimators, " << path << ".txt vs. .dat" << std::endl;
+    std::cout << std::setw(16) << "estimator" << std::setw(12) << "ms tokens" << std::setw(12) << "ms table" << std::endl;
+    auto row = [&](const char *name, auto on_tokens, auto on_table) {
+        const double t_tokens = time_per_run([&]() {
+            std::vector<std::string> Z;
+            read_stream(Z, path + ".txt");
+            bench_sink = on_tokens(Z);
+        });
+        const double t_table = time_per_run([&]() {
+            std::vector<std::string> K;
+            std::vector<uint64_t> C;
+            read_frequencies(K, C, path + ".dat");
+            bench_sink = on_table(K, C);
+        });
+        std::cout << std::fixed << std::setprecision(2) << std::setw(16) << name
+                  << std::setw(12) << t_tokens * 1e3
+                  << std::setw(12) << t_table * 1e3 << std::endl;
+    };
+    row("hll logm=10", [&](const auto &Z) { return hll(hash, Z, 10); },
+                       [&](const auto &K, const auto &C) { return hll_weighted(hash, K, C, 10); });
+    row("rec k=256", [&](const auto &Z) { return rec(hash, Z, 256); },
+                     [&](const auto &K, const auto &C) { return rec_weighted(hash, K, C, 256); });
+    row("rec_nohash k=256", [&](const auto &Z) { return rec_nohash(Z, 256); },
+                            [&](const auto &K, const auto &C) { return rec_nohash_weighted(K, C, 256, 1); });
+    row("cardinality", [&](const auto &Z) { return (double)cardinality(Z); },
+                       [&](const auto &K, const auto &C) { return (double)cardinality_weighted(K, C); });
+}
+
+
+/**
+ * war-peace for repeated trials: loading the text (tokenizing) vs. the encoded stream, and
+ * hashing per trial the words vs. the ids (by the dictionary) vs. the dictionary alone.
+ */
+void encoded_stream_benchmark()
+{
+    const std::string path = "../datasets/war-peace.txt";
+    const std::string cache = std::filesystem::temp_directory_path().string() + "/war-peace.enc";
+    clhasher hash(bench_rng(), bench_rng());
+    std::remove(cache.c_str());
+    const double t_encode = time_per_run([&]() { EncodedStream S = load_encoded_stream(path, cache); bench_sink = S.size(); }, 0.0);
+    const double t_text = time_per_run([&]() { MappedStream M(path); bench_sink = M.tokens().size(); });
+    const double t_load = time_per_run([&]() { EncodedStream S = load_encoded_stream(path, cache); bench_sink = S.size(); });
+
+    MappedStream M(path);
+    EncodedStream S(cache);
+    std::vector<uint64_t> Y;
+    const double t_words = time_per_run([&]() { hash_stream(Y, hash, M.tokens()); bench_sink = Y[0]; });
+    const double t_ids = time_per_run([&]() { hash_stream(Y, hash, S); bench_sink = Y[0]; });
+    const double t_keys = time_per_run([&]() { hash_keys(Y, hash, S); bench_sink = Y[0]; });
+    std::cout << "Encoded stream, " << path << " (" << S.size() << " words, " << S.num_keys() << " keys)" << std::endl;
+    std::cout << std::fixed << std::setprecision(3)
+              << "  encode (first run) " << t_encode * 1e3 << " ms, tokenize text " << t_text * 1e3
+              << " ms, load encoded " << t_load * 1e3 << " ms" << std::endl
+              << "  hash per trial: words " << t_words * 1e3 << " ms, ids " << t_ids * 1e3
+              << " ms, dictionary " << t_keys * 1e3 << " ms" << std::endl;
+    std::remove(cache.c_str());
+}
+
+
+/**
+ * clhash of the words of war-peace (and of 2^20 ints): one call per key vs. hash_many(); ints
+ * also through clhash() itself, bypassing the fixed width path.
+ */
+void clhash_batch_benchmark()
+{
+    clhasher hash(bench_rng(), bench_rng());
+    MappedStream M("../datasets/war-peace.txt");
+    const std::vector<std::string_view> &Z = M.tokens();
+    std::vector<int> I(1 << 20);
+    for (int &z : I)  z = (int)bench_rng();
+    std::vector<uint64_t> Y(std::max(Z.size(), I.size()));
+    std::cout << "clhash, ns per key" << std::endl;
+    std::cout << std::setw(10) << "keys" << std::setw(12) << "scalar" << std::setw(12) << "hash_many" << std::endl;
+    auto row = [&](const char *name, const auto &K) {
+        const double t_scalar = time_per_run([&]() {
+            for (size_t j = 0; j < K.size(); j++)  Y[j] = hash(K[j]);
+            bench_sink = Y[0];
+        });
+        const double t_batch = time_per_run([&]() { hash.hash_many(K.data(), K.size(), Y.data()); bench_sink = Y[0]; });
+        std::cout << std::fixed << std::setprecision(2) << std::setw(10) << name
+                  << std::setw(12) << t_scalar * 1e9 / K.size()
+                  << std::setw(12) << t_batch * 1e9 / K.size() << std::endl;
+    };
+    row("words", Z);
+    row("ints", I);
+    /* ints through the variable length path, as before the fixed width specializations */
+    const double t_generic = time_per_run([&]() {
+        for (size_t j = 0; j < I.size(); j++)  Y[j] = clhash(hash.random_data_, (const char *)&I[j], sizeof(int));
+        bench_sink = Y[0];
+    });
+    std::cout << std::fixed << std::setprecision(2) << std::setw(10) << "ints (var)"
+              << std::setw(12) << t_generic * 1e9 / I.size() << std::endl;
+}
+
+
+/**
+ * Sketch store: create (capacity 100, rounded up), insert into 2^12 keys (growing the file),
+ * merge keys pairwise, reopen and estimate, for both register layouts.
+ */
+void sketch_store_benchmark()
+{
+    constexpr int logm = 8;
+    constexpr uint64_t num_keys = 1 << 12;
+    constexpr size_t per_key = 1 << 11;
+    const std::string path = std::filesystem::temp_directory_path().string() + "/bench.hllstore";
+    std::vector<uint64_t> Y(per_key);
+
+    std::cout << "Sketch store, " << num_keys << " keys, " << per_key << " hashes each, m = " << (1 << logm) << std::endl;
+    std::cout << std::setw(10) << "layout" << std::setw(14) << "insert ns/h" << std::setw(14) << "merge us/key"
+              << std::setw(14) << "reopen ms" << std::setw(14) << "est us/key" << std::setw(12) << "mean err" << std::endl;
+    for (SketchStore::layout reg_layout : {SketchStore::bytes8, SketchStore::packed6})
+    {
+        std::remove(path.c_str());
+        double t_insert, t_merge;
+        {
+            SketchStore S(path, logm, reg_layout, 100);
+            const auto start = std::chrono::steady_clock::now();
+            for (uint64_t key = 0; key < num_keys; key++)
+            {
+                for (auto &y : Y)  y = bench_rng();
+                S.add(key, Y.data(), Y.size());
+            }
+            t_insert = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            /* key + num_keys gets the union of keys 2i and 2i+1 */
+            const auto start_merge = std::chrono::steady_clock::now();
+            for (uint64_t key = 0; key < num_keys; key += 2)
+            {
+                S.merge(num_keys + key, key);
+                S.merge(num_keys + key, key + 1);
+            }
+            t_merge = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_merge).count();
+            S.sync();
+        }
+        const double t_reopen = time_per_run([&]() { SketchStore S(path); bench_sink = S.size(); });
+
+        SketchStore S(path);
+        double err = 0.0;
+        const double t_estimate = time_per_run([&]() {
+            err = 0.0;
+            for (uint64_t key = 0; key < num_keys; key++)  err += S.estimate(key) / per_key - 1.0;
+            for (uint64_t key = 0; key < num_keys; key += 2)  err += S.estimate(num_keys + key) / (2*per_key) - 1.0;
+        });
+        const uint64_t num_estimates = num_keys + num_keys / 2;
+        std::cout << std::fixed << std::setw(10) << (reg_layout == SketchStore::bytes8 ? "bytes8" : "packed6")
+                  << std::setprecision(2) << std::setw(14) << t_insert * 1e9 / (num_keys * per_key)
+                  << std::setw(14) << t_merge * 1e6 / num_keys
+                  << std::setw(14) << t_reopen * 1e3
+                  << std::setw(14) << t_estimate * 1e6 / num_estimates
+                  << std::setprecision(4) << std::setw(12) << err / num_estimates
+                  << "  (" << S.size() << " keys, capacity " << S.capacity() << ")" << std::endl;
+    }
+    std::remove(path.c_str());
+}
+
+
+int main()
+{
+    hll_kernel_benchmark();
+    hll_layout_benchmark();
+    hll_sparse_benchmark();
+    hll_concurrent_benchmark();
+    hll_sliding_benchmark();
+    rec_kernel_benchmark();
+    rec_ingest_benchmark();
+    theta_benchmark();
+    cardinality_benchmark();
+    cardinality_external_benchmark();
+    stream_benchmark();
+    zipfian_benchmark();
+    frequency_benchmark();
+    encoded_stream_benchmark();
+    clhash_batch_benchmark();
+    sketch_store_benchmark();
+}
@@ -352,6 +352,95 @@ uint64_t clhash(const void* random, const char * stringbyte,
 }
 
 
+// the last (partial) word of a string of lengthbyte bytes, zero padded as createLastWord does,
+// without memcpy and without reading past the end of the string
+static inline uint64_t loadLastWord(const char * stringbyte, const size_t lengthbyte) {
+    const size_t significantbytes = lengthbyte % sizeof(uint64_t);
+    const char * lastw = stringbyte + (lengthbyte - significantbytes);
+    if (lengthbyte >= sizeof(uint64_t)) { // load the 8 bytes ending at the end of the string
+        uint64_t w;
+        memcpy(&w, stringbyte + lengthbyte - sizeof(uint64_t), sizeof(w));
+        return w >> (8 * (sizeof(uint64_t) - significantbytes));
+    }
+    // two overlapping loads covering the significant bytes
+    if (significantbytes >= 4) {
+        uint32_t lo, hi;
+        memcpy(&lo, lastw, 4);
+        memcpy(&hi, lastw + significantbytes - 4, 4);
+        return (uint64_t)lo | ((uint64_t)hi << (8 * (significantbytes - 4)));
+    }
+    if (significantbytes >= 2) {
+        uint16_t lo, hi;
+        memcpy(&lo, lastw, 2);
+        memcpy(&hi, lastw + significantbytes - 2, 2);
+        return (uint64_t)lo | ((uint64_t)hi << (8 * (significantbytes - 2)));
+    }
+    return (unsigned char) lastw[0];
+}
+
+// clhash of a short string (at most 128 words): the words, the last one zero padded, go in pairs
+// into the half scalar product, followed by the length hash and the reduction (the short string
+// branch of clhash, with the tail cases folded into one).
+static inline uint64_t clhashShort(const __m128i * rs64, const uint64_t keylength,
+                                   const char * stringbyte, const size_t lengthbyte) {
+    const size_t length = lengthbyte / sizeof(uint64_t); // # of complete words
+    const uint64_t * string = (const uint64_t *) stringbyte;
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 1 < length; i += 2, rs64 += 1) {
+        const __m128i add1 = _mm_xor_si128(_mm_load_si128(rs64), _mm_lddqu_si128((const __m128i *) (string + i)));
+        acc = _mm_xor_si128(_mm_clmulepi64_si128(add1, add1, 0x10), acc);
+    }
+    // one or two words left: a complete word and/or the partial word
+    if (i < length || lengthbyte % sizeof(uint64_t) != 0) {
+        uint64_t w0, w1 = 0;
+        if (i < length) {
+            memcpy(&w0, string + i, sizeof(w0));
+            if (lengthbyte % sizeof(uint64_t) != 0) w1 = loadLastWord(stringbyte, lengthbyte);
+        } else {
+            w0 = loadLastWord(stringbyte, lengthbyte);
+        }
+        const __m128i add1 = _mm_xor_si128(_mm_load_si128(rs64), _mm_set_epi64x(w1, w0));
+        acc = _mm_xor_si128(_mm_clmulepi64_si128(add1, add1, 0x10), acc);
+    }
+    acc = _mm_xor_si128(acc, lazyLengthHash(keylength, (uint64_t)lengthbyte));
+#ifdef BITMIX
+    return fmix64(precompReduction64(acc));
+#else
+    return precompReduction64(acc);
+#endif
+}
+
+void clhash_batch(const void* random, const char * const * keys, const size_t * lengths,
+                  const size_t n, uint64_t * out) {
+    assert(((uintptr_t) random & 15) == 0);// we expect cache line alignment for the keys
+    const unsigned int m = 128;
+    const __m128i * rs64 = (const __m128i *) random;
+    const uint64_t keylength = *(const uint64_t *)(rs64 + m / 2 + 2);
+    // four keys per iteration: the inlined hashes are independent, so their clmul and
+    // reduction chains overlap
+    size_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+        if (lengths[j] > m * sizeof(uint64_t) || lengths[j + 1] > m * sizeof(uint64_t)
+                || lengths[j + 2] > m * sizeof(uint64_t) || lengths[j + 3] > m * sizeof(uint64_t)) {
+            for (size_t l = j; l < j + 4; l++) out[l] = clhash(random, keys[l], lengths[l]);
+            continue;
+        }
+        const uint64_t h0 = clhashShort(rs64, keylength, keys[j], lengths[j]);
+        const uint64_t h1 = clhashShort(rs64, keylength, keys[j + 1], lengths[j + 1]);
+        const uint64_t h2 = clhashShort(rs64, keylength, keys[j + 2], lengths[j + 2]);
+        const uint64_t h3 = clhashShort(rs64, keylength, keys[j + 3], lengths[j + 3]);
+        out[j] = h0;
+        out[j + 1] = h1;
+        out[j + 2] = h2;
+        out[j + 3] = h3;
+    }
+    for (; j < n; j++) {
+        out[j] = lengths[j] > m * sizeof(uint64_t) ? clhash(random, keys[j], lengths[j])
+                                                   : clhashShort(rs64, keylength, keys[j], lengths[j]);
+    }
+}
+
 /***************************
  * Rest is optional random-number generation stuff
  */
@@ -45,6 +45,15 @@ uint64_t clhash(const void* random, const char * stringbyte,
 
 
 
+/**
+ * clhash of n keys at once, out[j] = clhash(random, keys[j], lengths[j]) (same values).
+ * Short keys (up to 1024 bytes) are hashed four at a time with interleaved carry-less
+ * multiplications, which pays off for many small keys such as words.
+ */
+void clhash_batch(const void* random, const char * const * keys, const size_t * lengths,
+                  const size_t n, uint64_t * out);
+
+
 /**
  * Convenience method. Will generate a random key from two 64-bit seeds.
  * Caller is responsible to call "free" on the result.
@@ -58,7 +67,71 @@ void * get_random_key_for_clhash(uint64_t seed1, uint64_t seed2);
 #ifdef __cplusplus
 #include <vector>
 #include <string>
+#include <string_view>
 #include <cstring> // For std::strlen
+#include <algorithm>
+#include <type_traits>
+
+#include <immintrin.h>
+
+/**
+ * clhash of keys of a fixed width of 4, 8 or 16 bytes: a single pair of words, so clhash
+ * reduces to (w0 ^ r0) * (w1 ^ r1) xor the length hash, reduced to 64 bits (the short string
+ * branch of clhash for one word pair, without length dispatch and tail handling). Same values
+ * as clhash. Other widths have no fixed path (available == false) and go through clhash.
+ */
+template<size_t width>
+struct clhash_fixed {
+    static constexpr bool available = false;
+};
+
+struct clhash_fixed_base {
+    static constexpr bool available = true;
+
+    static uint64_t hash_words(const void *random, uint64_t w0, uint64_t w1, uint64_t lengthbyte) {
+        const uint64_t *r = (const uint64_t *)random;
+        const uint64_t keylength = r[RANDOM_64BITWORDS_NEEDED_FOR_CLHASH - 1];
+        const __m128i add = _mm_set_epi64x((long long)(r[1] ^ w1), (long long)(r[0] ^ w0));
+        const __m128i lengthvector = _mm_set_epi64x((long long)keylength, (long long)lengthbyte);
+        const __m128i acc = _mm_xor_si128(_mm_clmulepi64_si128(add, add, 0x10),
+                                          _mm_clmulepi64_si128(lengthvector, lengthvector, 0x10));
+        /* reduction modulo the irreducible polynomial x^64 + x^4 + x^3 + x + 1 (see clhash.cpp) */
+        const __m128i C = _mm_cvtsi64_si128((1U<<4)+(1U<<3)+(1U<<1)+(1U<<0));
+        const __m128i Q2 = _mm_clmulepi64_si128(acc, C, 0x01);
+        const __m128i Q3 = _mm_shuffle_epi8(_mm_setr_epi8(0, 27, 54, 45, 108, 119, 90, 65, (char)216, (char)195, (char)238, (char)245, (char)180, (char)175, (char)130, (char)153),
+                                            _mm_srli_si128(Q2, 8));
+        return (uint64_t)_mm_cvtsi128_si64(_mm_xor_si128(Q3, _mm_xor_si128(Q2, acc)));
+    }
+};
+
+#ifndef BITMIX // the fixed paths don't mix the bits as clhash then does
+template<>
+struct clhash_fixed<4> : clhash_fixed_base {
+    static uint64_t hash(const void *random, const char *bytes) {
+        uint32_t w;
+        std::memcpy(&w, bytes, 4);
+        return hash_words(random, w, 0, 4);
+    }
+};
+
+template<>
+struct clhash_fixed<8> : clhash_fixed_base {
+    static uint64_t hash(const void *random, const char *bytes) {
+        uint64_t w;
+        std::memcpy(&w, bytes, 8);
+        return hash_words(random, w, 0, 8);
+    }
+};
+
+template<>
+struct clhash_fixed<16> : clhash_fixed_base {
+    static uint64_t hash(const void *random, const char *bytes) {
+        uint64_t w[2];
+        std::memcpy(w, bytes, 16);
+        return hash_words(random, w[0], w[1], 16);
+    }
+};
+#endif
 
 struct clhasher {
     const void *random_data_;
@@ -70,7 +143,10 @@ struct clhasher {
     uint64_t operator()(const char *str) const {return operator()(str, std::strlen(str));}
     template<typename T>
     uint64_t operator()(const T &input) const {
-        return operator()((const char *)&input, sizeof(T));
+        if constexpr (has_fixed_path<T>())
+            return clhash_fixed<sizeof(T)>::hash(random_data_, (const char *)&input);
+        else
+            return operator()((const char *)&input, sizeof(T));
     }
     template<typename T>
     uint64_t operator()(const std::vector<T> &input) const {
@@ -79,9 +155,54 @@ struct clhasher {
     uint64_t operator()(const std::string &str) const {
         return operator()(str.data(), str.size());
     }
+    uint64_t operator()(std::string_view str) const {
+        return operator()(str.data(), str.size());
+    }
+    /**
+     * out[j] = operator()(Z[j]) for j < n, hashed in batches through clhash_batch.
+     */
+    void hash_many(const char *const *keys, const size_t *lengths, size_t n, uint64_t *out) const {
+        clhash_batch(random_data_, keys, lengths, n, out);
+    }
+    void hash_many(const std::string *Z, size_t n, uint64_t *out) const {
+        hash_many_impl(Z, n, out, [](const std::string &z) { return std::string_view(z); });
+    }
+    void hash_many(const std::string_view *Z, size_t n, uint64_t *out) const {
+        hash_many_impl(Z, n, out, [](std::string_view z) { return z; });
+    }
+    template<typename T>
+    void hash_many(const T *Z, size_t n, uint64_t *out) const {
+        static_assert(std::is_trivially_copyable<T>::value, "hash_many hashes the bytes of T.");
+        if constexpr (has_fixed_path<T>()) {
+            for (size_t j = 0; j < n; j++) out[j] = clhash_fixed<sizeof(T)>::hash(random_data_, (const char *)(Z + j));
+        } else {
+            hash_many_impl(Z, n, out, [](const T &z) { return std::string_view((const char *)&z, sizeof(T)); });
+        }
+    }
     ~clhasher() {
         std::free((void *)random_data_);
     }
+private:
+    template<typename T>
+    static constexpr bool has_fixed_path() {
+        return std::is_trivially_copyable<T>::value && clhash_fixed<sizeof(T)>::available;
+    }
+
+    template<typename T, typename F>
+    void hash_many_impl(const T *Z, size_t n, uint64_t *out, F bytes) const {
+        constexpr size_t block = 64;
+        const char *keys[block];
+        size_t lengths[block];
+        for (size_t j = 0; j < n; j += block) {
+            const size_t b = std::min(block, n - j);
+            for (size_t l = 0; l < b; l++) {
+                const std::string_view s = bytes(Z[j + l]);
+                keys[l] = s.data();
+                lengths[l] = s.size();
+            }
+            clhash_batch(random_data_, keys, lengths, b, out + j);
+        }
+    }
 };
 #endif // #ifdef __cplusplus
 
@@ -1,42 +1,278 @@
 #pragma once
 
 #include <random>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cassert>
+#include <thread>
+#include <atomic>
+#include <iterator>
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <fstream>
 #include <iostream>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "clhash/clhash.h"
 
 std::mt19937 ds_rng(*(int*)"shhh");
 
 /**
- * Generate a synthetic datastream following a Zipfian law.
- * 
- * out_Z     datastream Z, is overwritten
- * stream_length    length of stream N
- * universe_size    size of distinct elements n (universe impicitely is {0,...,n-1})
- * alpha            parameter of Zipfian law
+ * SplitMix64 random number generator: 8 bytes of state, so cheap to seed and copy, e.g. one per
+ * chunk of a generated stream.
  */
-inline void generate_zipfian(std::vector<int>& out_Z, int stream_length, int universe_size, float alpha)
+struct SplitMix64
 {
-    /* prepare weights */
-    std::vector<float> weights;
-    weights.resize(universe_size);
-    for (int i = 0; i < universe_size; i++)
+    using result_type = uint64_t;
+    uint64_t state;
+
+    explicit SplitMix64(uint64_t seed) : state(seed) {}
+
+    static constexpr uint64_t min() { return 0; }
+    static constexpr uint64_t max() { return ~uint64_t(0); }
+
+    uint64_t operator()()
     {
-        weights[i] = std::pow((float)i, -alpha); // scaling is implicit in discrete_distribution
+        uint64_t z = (state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
     }
+};
 
-    std::discrete_distribution<int> d(weights.begin(), weights.end());
 
-    /* generate random instances and populate Z */
-    out_Z.clear();
-    out_Z.resize(stream_length);
-    for (int j = 0; j < stream_length; j++)
+/**
+ * Zipfian law on {0, ..., n-1}: P(i) proportional to (i+1)^(-alpha). Sampled by rejection-
+ * inversion (Hoermann, Derflinger: Rejection-inversion to generate variates from monotone
+ * discrete distributions, 1996) in O(1) time per sample and memory, without a table of weights;
+ * the expected number of rejections per sample is below 1 for any n, alpha. alpha = 0 (uniform)
+ * is drawn directly.
+ */
+class ZipfianDistribution
+{
+public:
+    /**
+     * universe_size    n, positive
+     * alpha            parameter of Zipfian law, non-negative
+     */
+    ZipfianDistribution(uint64_t universe_size, double alpha)
+        : n_(universe_size), alpha_(alpha)
+    {
+        assert(universe_size >= 1 && alpha >= 0 && "Zipfian law needs n >= 1, alpha >= 0.");
+        h_integral_x1_ = h_integral(1.5) - 1;
+        h_integral_n_ = h_integral(n_ + 0.5);
+        s_ = 2 - h_integral_inverse(h_integral(2.5) - h(2));
+    }
+
+    /**
+     * Draw from rng (64 bit output).
+     */
+    template <typename rng_type>
+    uint64_t operator()(rng_type &rng) const
     {
-        out_Z[j] = d(ds_rng);
+        if (alpha_ == 0)
+            return std::min<uint64_t>(n_ - 1, (uint64_t)(uniform(rng) * n_));
+        while (true)
+        {
+            /* invert the integral of h at a uniform point, round to the closest integer k, and
+               accept k if it lies in the area under the histogram of P */
+            const double u = h_integral_n_ + uniform(rng) * (h_integral_x1_ - h_integral_n_);
+            const double x = h_integral_inverse(u);
+            const uint64_t k = std::clamp<uint64_t>((uint64_t)(x + 0.5), 1, n_);
+            if (k - x <= s_ || u >= h_integral(k + 0.5) - h(k))
+                return k - 1;
+        }
     }
+
+private:
+    uint64_t n_;
+    double alpha_;
+    double h_integral_x1_;
+    double h_integral_n_;
+    double s_;
+
+    /* uniform on [0, 1) from the top 53 bits */
+    template <typename rng_type>
+    static double uniform(rng_type &rng)
+    {
+        return (double)(rng() >> 11) * 0x1p-53;
+    }
+
+    /* h(x) = x^(-alpha) */
+    double h(double x) const
+    {
+        return std::exp(-alpha_ * std::log(x));
+    }
+
+    /* integral of h, (x^(1-alpha) - 1) / (1-alpha), continuous in alpha = 1 (log x) */
+    double h_integral(double x) const
+    {
+        const double log_x = std::log(x);
+        return expm1_over_x((1 - alpha_) * log_x) * log_x;
+    }
+
+    double h_integral_inverse(double x) const
+    {
+        double t = x * (1 - alpha_);
+        if (t < -1)  t = -1; /* rounding */
+        return std::exp(log1p_over_x(t) * x);
+    }
+
+    /* log(1+x)/x and (exp(x)-1)/x, by Taylor series close to 0 */
+    static double log1p_over_x(double x)
+    {
+        return std::abs(x) > 1e-8 ? std::log1p(x) / x : 1 - x * (0.5 - x * (1.0/3 - 0.25 * x));
+    }
+    static double expm1_over_x(double x)
+    {
+        return std::abs(x) > 1e-8 ? std::expm1(x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+    }
+};
+
+
+/**
+ * Synthetic data stream following a Zipfian law, defined by its length, law and a seed but never
+ * held in memory: it is drawn in chunks of chunk_length elements, each from its own generator
+ * seeded from (seed, chunk index). Iterating it (a lazy range, e.g. for range_source()) and
+ * generate() with any number of threads give the same stream.
+ *
+ * Memory: O(1)
+ */
+class ZipfianStream
+{
+public:
+    static constexpr uint64_t chunk_length = 1 << 16;
+
+    /**
+     * stream_length    length of stream N
+     * universe_size    size of distinct elements n (universe impicitely is {0,...,n-1})
+     * alpha            parameter of Zipfian law
+     * seed             seed of the stream
+     */
+    ZipfianStream(uint64_t stream_length, int universe_size, double alpha, uint64_t seed)
+        : length_(stream_length), law_(universe_size, alpha), seed_(seed)
+    {}
+
+    uint64_t size() const { return length_; }
+
+    /**
+     * Input iterator over the stream, drawing the elements as it advances.
+     */
+    class iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = int;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const int *;
+        using reference = const int &;
+
+        iterator(const ZipfianStream *stream, uint64_t j)
+            : stream_(stream), j_(j), rng_(0)
+        {
+            if (j_ < stream_->length_)
+            {
+                rng_ = stream_->chunk_rng(j_ / chunk_length);
+                for (uint64_t i = j_ - j_ % chunk_length; i < j_; i++)  stream_->draw(rng_);
+                z_ = stream_->draw(rng_);
+            }
+        }
+
+        reference operator*() const { return z_; }
+        pointer operator->() const { return &z_; }
+
+        iterator &operator++()
+        {
+            if (++j_ < stream_->length_)
+            {
+                if (j_ % chunk_length == 0)  rng_ = stream_->chunk_rng(j_ / chunk_length);
+                z_ = stream_->draw(rng_);
+            }
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            iterator it = *this;
+            ++*this;
+            return it;
+        }
+
+        bool operator==(const iterator &other) const { return j_ == other.j_; }
+        bool operator!=(const iterator &other) const { return j_ != other.j_; }
+
+    private:
+        const ZipfianStream *stream_;
+        uint64_t j_;
+        SplitMix64 rng_;
+        int z_ = 0;
+    };
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, length_); }
+
+    /**
+     * Materialize the stream with num_threads threads, taking chunks in turn.
+     *
+     * out_Z        datastream Z, is overwritten
+     */
+    void generate(std::vector<int> &out_Z, int num_threads) const
+    {
+        out_Z.resize(length_);
+        const uint64_t num_chunks = (length_ + chunk_length - 1) / chunk_length;
+        std::atomic<uint64_t> next_chunk(0);
+        auto work = [&]() {
+            for (uint64_t c; (c = next_chunk++) < num_chunks; )
+            {
+                SplitMix64 rng = chunk_rng(c);
+                for (uint64_t j = c * chunk_length; j < std::min(length_, (c + 1) * chunk_length); j++)
+                {
+                    out_Z[j] = draw(rng);
+                }
+            }
+        };
+        std::vector<std::thread> threads;
+        for (int t = 1; t < num_threads; t++)  threads.emplace_back(work);
+        work();
+        for (auto &thread : threads)  thread.join();
+    }
+
+private:
+    uint64_t length_;
+    ZipfianDistribution law_;
+    uint64_t seed_;
+
+    SplitMix64 chunk_rng(uint64_t c) const
+    {
+        /* scramble (seed, c), so that the chunks start at unrelated points of the sequence */
+        SplitMix64 mix(seed_ ^ (c * 0xd1342543de82ef95));
+        return SplitMix64(mix());
+    }
+
+    int draw(SplitMix64 &rng) const { return (int)law_(rng); }
+};
+
+
+/**
+ * Generate a synthetic datastream following a Zipfian law (see ZipfianStream), seeded from ds_rng.
+ * 
+ * out_Z     datastream Z, is overwritten
+ * stream_length    length of stream N
+ * universe_size    size of distinct elements n (universe impicitely is {0,...,n-1})
+ * alpha            parameter of Zipfian law, P(i) proportional to (i+1)^(-alpha)
+ * num_threads      threads generating chunks of the stream in parallel
+ */
+inline void generate_zipfian(std::vector<int>& out_Z, int stream_length, int universe_size, float alpha,
+                             int num_threads = std::thread::hardware_concurrency())
+{
+    ZipfianStream(stream_length, universe_size, alpha, ds_rng()).generate(out_Z, std::max(1, num_threads));
 }
 
+
 /**
  * Read a data stream (of words) from a file.
  * 
@@ -58,4 +294,141 @@ inline void read_stream(std::vector<std::string>& out_Z, std::string filepath)
     {
         out_Z.push_back(z);
     }
-}
\ No newline at end of file
+}
+
+
+/**
+ * Read a pre-aggregated data stream from a file of "key: count" lines (as the .dat files in datasets/): the
+ * distinct keys and their multiplicities in the stream. Keys are everything before the last ':'
+ * of a line, blank lines are skipped.
+ * 
+ * Some .txt files start with a UTF-8 byte order mark (war-peace, valley-fear), which
+ * read_stream() keeps as part of the first word. The .dat files count that word and its later
+ * occurrences without the mark as one key, spelled with the mark: war-peace.dat has
+ * "\xEF\xBB\xBFbook": 71, where the text has "\xEF\xBB\xBFbook" once and "book" 70 times, so
+ * one more distinct word than the table has keys.
+ * 
+ * out_K        keys, is overwritten
+ * out_C        multiplicities, out_C[i] for out_K[i], is overwritten
+ * filepath     path to file
+ */
+inline void read_frequencies(std::vector<std::string>& out_K, std::vector<uint64_t>& out_C, std::string filepath)
+{
+    std::ifstream datastream(filepath, std::ios_base::in);
+    if (!datastream.is_open())
+    {
+        std::cerr << "Couldn't open frequency input file!\n";
+        throw;
+    }
+
+    out_K.clear();
+    out_C.clear();
+    std::string line;
+    while (std::getline(datastream, line))
+    {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)  continue;
+        const size_t colon = line.rfind(':');
+        char *end = nullptr;
+        const uint64_t count = (colon == std::string::npos) ? 0 : std::strtoull(line.c_str() + colon + 1, &end, 10);
+        if (colon == std::string::npos || end == line.c_str() + colon + 1)
+        {
+            std::cerr << "Couldn't parse frequency line \"" << line << "\"!\n";
+            throw;
+        }
+        out_K.push_back(line.substr(0, colon));
+        out_C.push_back(count);
+    }
+}
+
+
+/**
+ * Data stream (of words) of a memory mapped file: the words are views into the mapping, split at
+ * white space like read_stream(), without a copy or allocation per word. The views stay valid
+ * as long as the MappedStream exists (also when it is moved).
+ */
+class MappedStream
+{
+public:
+    /**
+     * filepath     path to file
+     */
+    explicit MappedStream(const std::string &filepath)
+    {
+        const int fd = open(filepath.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            std::cerr << "Couldn't open data stream input file!\n";
+            throw;
+        }
+        size_ = (size_t)st.st_size;
+        if (size_ > 0)
+        {
+            void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED)
+            {
+                std::cerr << "Couldn't map data stream input file!\n";
+                throw;
+            }
+            data_ = (const char *)data;
+            madvise(data, size_, MADV_SEQUENTIAL);
+        }
+        close(fd);
+        tokenize();
+    }
+    MappedStream(MappedStream &&other) noexcept
+        : data_(other.data_), size_(other.size_), Z_(std::move(other.Z_))
+    {
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+    MappedStream(const MappedStream &) = delete;
+    MappedStream &operator=(const MappedStream &) = delete;
+    ~MappedStream()
+    {
+        if (data_ != nullptr)  munmap((void *)data_, size_);
+    }
+
+    /* the words of the stream, in order */
+    const std::vector<std::string_view> &tokens() const { return Z_; }
+    operator const std::vector<std::string_view> &() const { return Z_; }
+
+private:
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    std::vector<std::string_view> Z_;
+
+    /* white space as for operator>> in the "C" locale */
+    static bool is_space(char c)
+    {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    void tokenize()
+    {
+        Z_.reserve(size_ / 6);
+        size_t i = 0;
+        while (i < size_)
+        {
+            while (i < size_ && is_space(data_[i]))  i++;
+            const size_t begin = i;
+            while (i < size_ && !is_space(data_[i]))  i++;
+            if (i > begin)  Z_.emplace_back(data_ + begin, i - begin);
+        }
+    }
+};
+
+
+/**
+ * Hash a data stream once, so that several estimators can share the hash values.
+ * 
+ * out_Y        hash values, out_Y[j] = hash(Z[j]), is overwritten
+ * hash         hash function (instance of clhasher struct)
+ * Z            data stream / multiset
+ */
+template <typename z_type>
+inline void hash_stream(std::vector<uint64_t>& out_Y, clhasher &hash, const std::vector<z_type> &Z)
+{
+    out_Y.resize(Z.size());
+    hash.hash_many(Z.data(), Z.size(), out_Y.data());
+}
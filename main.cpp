@@ -1,4 +1,5 @@
 #include "datastreams.hpp"
+#include "EncodedStream.hpp"
 #include "PerfectCounting.hpp"
 #include "HyperLogLog.hpp"
 #include "Recordinality.hpp"
@@ -8,6 +9,7 @@
 #include <iomanip>
 #include <numeric>
 #include <string>
+#include <thread>
 
 std::mt19937_64 rng(*(int*)"clha");
 
@@ -22,19 +24,20 @@ void real_experimets()
     constexpr int num_datasets = 8;
     const char *datasets[num_datasets] = {"crusoe", "dracula", "iliad", "mare-balena", "midsummer-nights-dream", "quijote", "valley-fear", "war-peace"};
     double datasets_card[num_datasets];
-    /* read in "real" datasets */
+    /* read in "real" datasets (dictionary encoded, converted on the first run) */
     std::cout << "Read in real datasets" << std::endl;
-    std::vector<std::vector<std::string>> Z(num_datasets);
+    std::vector<EncodedStream> Z;
     for (int d = 0; d < num_datasets; d++)
     {
         std::string filename = datasets[d];
-        read_stream(Z[d], "../datasets/" + filename + ".txt");
+        Z.push_back(load_encoded_stream("../datasets/" + filename + ".txt", "../datasets/" + filename + ".enc"));
     }
-    /* calculate their cardinalities */
+    /* their cardinalities, counted exactly on the decoded words (the dictionaries need to agree) */
     for (int d = 0; d < num_datasets; d++)
     {
         std::cout << "Calculate dataset cardinality " << d << std::endl;
-        datasets_card[d] = cardinality(Z[d]);
+        datasets_card[d] = cardinality(Z[d].tokens());
+        assert(datasets_card[d] == Z[d].num_keys() && "Dictionary of encoded stream is not the set of its words.");
     }
 
     /* Experiments on all "real" datasets */
@@ -57,27 +60,32 @@ void real_experimets()
             /* Instantiate a random hash function (common for all algorithm variations throughout trial) */
             clhasher h(rng(), rng()); // NOTE: clhasher is a really shitty class that doesn't properly handle memory resources 
                                      // --> do not copy, move, etc..!!!
-            /* HyperLogLog */
+            /* Hash the dictionary once (common for all algorithm variations throughout trial):
+               HLL and Recordinality only depend on the first occurrences, in order */
+            std::vector<uint64_t> Y;
+            hash_keys(Y, h, Z[d]);
+            /* HyperLogLog (all m from one scan) */
+            std::cout << "Dataset " << d << " - HLL" << std::endl;
+            std::vector<double> estimates = hll_hashed(Y.data(), Y.size(), logm);
             for (int i = 0; i < (int)logm.size(); i++)
             {
-                std::cout << "Dataset " << d << " - HLL" << uiexp2(logm[i]) << std::endl;
-                double estimate = hll(h, Z[d], logm[i]);
-                hll_estimates[i].push_back(estimate);
+                hll_estimates[i].push_back(estimates[i]);
             }
-            /* Recordinality */
+            /* Recordinality (all k from one scan) */
+            std::cout << "Dataset " << d << " - REC" << std::endl;
+            estimates = rec_hashed(Y.data(), Y.size(), k);
             for (int i = 0; i < (int)k.size(); i++)
             {
-                std::cout << "Dataset " << d << " - REC" << k[i] << std::endl;
-                double estimate = rec(h, Z[d], k[i]);
-                rec_estimates[i].push_back(estimate);
+                rec_estimates[i].push_back(estimates[i]);
             }
             /* Recordinality without hash function */
             if (trial == 0)
             {
+                const std::vector<std::string_view> tokens = Z[d].tokens();
                 for (int i = 0; i < (int)k.size(); i++)
                 {
                     std::cout << "Dataset " << d << " - RECnh" << k[i] << std::endl;
-                    double estimate = rec_nohash(Z[d], k[i]);
+                    double estimate = rec_nohash(tokens, k[i]);
                     re2_estimates[i].push_back(estimate);
                 }
             }
@@ -224,7 +232,7 @@ void synthetic_experimets()
     {
         std::cout << "Dataset " << d << " (" << stream_length << ")" << std::endl;
         generate_zipfian(Z[d], stream_length, stream_length, 0.0);
-        datasets_card[d] = cardinality(Z[d]);
+        datasets_card[d] = cardinality(Z[d], std::thread::hardware_concurrency());
     }
 
     /* Experiments on all generated datasets */
@@ -241,19 +249,22 @@ void synthetic_experimets()
             /* Instantiate a random hash function (common for all algorithm variations throughout trial) */
             clhasher h(rng(), rng()); // NOTE: clhasher is a really shitty class that doesn't properly handle memory resources 
                                      // --> do not copy, move, etc..!!!
-            /* HyperLogLog */
+            /* Hash the stream once (common for all algorithm variations throughout trial) */
+            std::vector<uint64_t> Y;
+            hash_stream(Y, h, Z[d]);
+            /* HyperLogLog (all m from one scan) */
+            std::cout << "Dataset " << d << " - HLL" << std::endl;
+            std::vector<double> estimates = hll_hashed(Y.data(), Y.size(), logm);
             for (int i = 0; i < (int)logm.size(); i++)
             {
-                std::cout << "Dataset " << d << " - HLL" << uiexp2(logm[i]) << std::endl;
-                double estimate = hll(h, Z[d], logm[i]);
-                hll_estimates[i].push_back(estimate);
+                hll_estimates[i].push_back(estimates[i]);
             }
-            /* Recordinality */
+            /* Recordinality (all k from one scan) */
+            std::cout << "Dataset " << d << " - REC" << std::endl;
+            estimates = rec_hashed(Y.data(), Y.size(), k);
             for (int i = 0; i < (int)k.size(); i++)
             {
-                std::cout << "Dataset " << d << " - REC" << k[i] << std::endl;
-                double estimate = rec(h, Z[d], k[i]);
-                rec_estimates[i].push_back(estimate);
+                rec_estimates[i].push_back(estimates[i]);
             }
         }
 